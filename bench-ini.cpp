@@ -0,0 +1,592 @@
+/*
+ Benchmark for INI File Processor.
+ Optimized INI text file processor for the embedded c++ system.
+ Written by Huirak Lee (huirak.lee@gmail.com)
+
+ Runs load, save, random get, random set and iteration over a matrix of
+ sections x items x value size, sorted or unsorted input, with or without CRC.
+
+ Usage : bench-ini [options]
+  --sections n,n..    section counts (default 10,100)
+  --items n,n..       items per section (default 100,1000)
+  --value-size n,n..  value lengths (default 16,256)
+  --reps n            passes of the load, save and iteration (default 5)
+  --ops n             random gets and sets per case (default 100000)
+  --json file         write the results as JSON, one benchmark per line
+  --baseline file     compare with the JSON of a previous run, exit 1 on a regression
+  --threshold pct     allowed throughput drop against the baseline (default 10)
+  --perf              count cycles, instructions, cache and branch misses per op (Linux)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "ini.h"
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+#ifdef WIN32
+#define EOL "\r\n"
+#else
+#define EOL "\n"
+#endif
+
+//Random get and set are timed in batches, a clock read per op would dominate a lookup.
+static const int opBatch = 16;
+
+enum PerfCounter {
+	PerfCycles,
+	PerfInstructions,
+	PerfL1DMisses,
+	PerfLLCMisses,
+	PerfBranchMisses,
+	PerfCount
+};
+static const char* perfNames[PerfCount] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+
+//Hardware counters of the calling thread by perf_event_open.
+//A counter the kernel or the CPU refuses reads -1, so the harness still runs in the VMs and containers.
+class PerfCounters
+{
+	int fds[PerfCount];
+public:
+	PerfCounters()
+	{
+		for (int i = 0; i < PerfCount; i++) {
+			fds[i] = -1;
+		}
+	}
+	~PerfCounters()
+	{
+		for (int i = 0; i < PerfCount; i++) {
+#if defined(__linux__)
+			if (fds[i] != -1) {
+				close(fds[i]);
+			}
+#endif
+		}
+	}
+	//Returns the number of the available counters.
+	int Open()
+	{
+		int opened = 0;
+#if defined(__linux__)
+		static const struct { unsigned int type; unsigned long long config; } events[PerfCount] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		};
+		for (int i = 0; i < PerfCount; i++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+			if (fds[i] == -1) {
+				fprintf(stderr, "perf_event_open %s : %s\n", perfNames[i], strerror(errno));
+			} else {
+				opened++;
+			}
+		}
+#endif
+		return opened;
+	}
+	void Start()
+	{
+		for (int i = 0; i < PerfCount; i++) {
+#if defined(__linux__)
+			if (fds[i] != -1) {
+				ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+				ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+	}
+	//Counts since the Start, scaled up if the kernel multiplexed the counters.
+	void Stop(double counts[PerfCount])
+	{
+		for (int i = 0; i < PerfCount; i++) {
+			counts[i] = -1;
+#if defined(__linux__)
+			if (fds[i] == -1) {
+				continue;
+			}
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			unsigned long long value[3];//value, time enabled, time running
+			if (read(fds[i], value, sizeof(value)) == sizeof(value) && value[2]) {
+				counts[i] = (double)value[0] * value[1] / value[2];
+			}
+#endif
+		}
+	}
+};
+
+struct Case
+{
+	int sections;
+	int items;
+	int valueSize;
+	bool sorted;
+	bool crc;
+};
+
+struct Result
+{
+	std::string name;
+	const char* op;
+	Case c;
+	const char* sample;	//"pass" for a whole file or table, "op" for a single get or set
+	size_t count;
+	double opsPerSec;	//items per second for the passes
+	double p50Ns;
+	double p99Ns;
+	double perf[PerfCount];	//per item or op, -1 if not counted
+};
+
+static inline unsigned long long
+NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double
+Percentile(std::vector<double>& samples, double percentile)
+{
+	if (samples.empty()) {
+		return 0;
+	}
+	size_t rank = (size_t)(samples.size() * percentile / 100.0);
+	if (rank >= samples.size()) {
+		rank = samples.size() - 1;
+	}
+	nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
+
+static unsigned int
+CRC32(const std::string& s)
+{
+	unsigned int crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < s.size(); i++) {
+		crc ^= (unsigned char)s[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+//Writes the input by hand, SaveFile always writes the sorted order.
+static bool
+WriteInput(const char* path, const Case& c, const std::vector<std::string>& sects, const std::vector<std::string>& keys, const std::string& val)
+{
+	std::vector<int> sectOrder(c.sections);
+	std::vector<int> itemOrder(c.items);
+	for (int i = 0; i < c.sections; i++) sectOrder[i] = i;
+	for (int i = 0; i < c.items; i++) itemOrder[i] = i;
+	mt19937 rng(1);
+	if (!c.sorted) {
+		shuffle(sectOrder.begin(), sectOrder.end(), rng);
+	}
+
+	std::string body;
+	for (int s = 0; s < c.sections; s++) {
+		if (!c.sorted) {
+			shuffle(itemOrder.begin(), itemOrder.end(), rng);
+		}
+		body += "[" + sects[sectOrder[s]] + "]" EOL;
+		for (int i = 0; i < c.items; i++) {
+			body += keys[itemOrder[i]] + "=" + val + EOL;
+		}
+		body += EOL;
+	}
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "fopen : %s (%s)\n", path, strerror(errno));
+		return false;
+	}
+	if (c.crc) {
+		fprintf(file, "CRC=%08X" EOL, CRC32(body));
+	}
+	bool ok = fwrite(body.data(), 1, body.size(), file) == body.size();
+	fclose(file);
+	return ok;
+}
+
+static std::string
+CaseName(const char* op, const Case& c)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s/s%d/i%d/v%d/%s/%s", op, c.sections, c.items, c.valueSize,
+		c.sorted ? "sorted" : "unsorted", c.crc ? "crc" : "nocrc");
+	return name;
+}
+
+static Result
+MakeResult(const char* op, const Case& c, const char* sample, std::vector<double>& samples, double opsPerSec, const double counts[PerfCount], double ops)
+{
+	Result r;
+	r.name = CaseName(op, c);
+	r.op = op;
+	r.c = c;
+	r.sample = sample;
+	r.count = samples.size();
+	r.opsPerSec = opsPerSec;
+	r.p50Ns = Percentile(samples, 50);
+	r.p99Ns = Percentile(samples, 99);
+	for (int i = 0; i < PerfCount; i++) {
+		r.perf[i] = counts[i] < 0 ? -1 : counts[i] / ops;
+	}
+	return r;
+}
+
+//The counters also count the clock reads of the timed loops.
+static void
+RunCase(const Case& c, int reps, int ops, PerfCounters& perf, std::vector<Result>& results)
+{
+	std::vector<std::string> sects(c.sections);
+	std::vector<std::string> keys(c.items);
+	char name[Ini::maxSectKeyLen];
+	for (int s = 0; s < c.sections; s++) {
+		snprintf(name, sizeof(name), "sect%06d", s);
+		sects[s] = name;
+	}
+	for (int i = 0; i < c.items; i++) {
+		snprintf(name, sizeof(name), "key%06d", i);
+		keys[i] = name;
+	}
+	std::string val(c.valueSize, 'v');
+	std::string setVal[2] = { std::string(c.valueSize, 'x'), std::string(c.valueSize, 'y') };
+	const char* path = "bench-input.ini";
+	const char* savePath = "bench-output.ini";
+	double items = (double)c.sections * c.items;
+
+	if (!WriteInput(path, c, sects, keys, val)) {
+		return;
+	}
+
+	std::vector<double> samples;
+	double counts[PerfCount];
+	unsigned long long total = 0;
+	perf.Start();
+	for (int r = 0; r < reps; r++) {
+		Ini ini;
+		unsigned long long start = NowNs();
+		if (!ini.LoadFile(path, c.crc)) {
+			fprintf(stderr, "LoadFile failed : %s\n", CaseName("load", c).c_str());
+			return;
+		}
+		unsigned long long ns = NowNs() - start;
+		total += ns;
+		samples.push_back((double)ns);
+	}
+	perf.Stop(counts);
+	results.push_back(MakeResult("load", c, "pass", samples, items * reps * 1e9 / total, counts, items * reps));
+
+	//The contents are the same for any input order, the rest runs once on the sorted input.
+	if (!c.sorted) {
+		return;
+	}
+	Ini ini;
+	ini.LoadFile(path, c.crc);
+
+	samples.clear();
+	total = 0;
+	perf.Start();
+	for (int r = 0; r < reps; r++) {
+		unsigned long long start = NowNs();
+		ini.SaveFile(savePath, c.crc);
+		unsigned long long ns = NowNs() - start;
+		total += ns;
+		samples.push_back((double)ns);
+	}
+	perf.Stop(counts);
+	results.push_back(MakeResult("save", c, "pass", samples, items * reps * 1e9 / total, counts, items * reps));
+	remove(savePath);
+
+	if (c.crc) {
+		return;
+	}
+
+	std::vector<int> picks(ops * 2);
+	mt19937 rng(2);
+	for (int i = 0; i < ops; i++) {
+		picks[i*2] = rng() % c.sections;
+		picks[i*2+1] = rng() % c.items;
+	}
+
+	samples.clear();
+	total = 0;
+	size_t found = 0;
+	perf.Start();
+	for (int i = 0; i + opBatch <= ops; i += opBatch) {
+		unsigned long long start = NowNs();
+		for (int j = i; j < i + opBatch; j++) {
+			found += ini.GetValueStr(sects[picks[j*2]].c_str(), keys[picks[j*2+1]].c_str(), NULL) != NULL;
+		}
+		unsigned long long ns = NowNs() - start;
+		total += ns;
+		samples.push_back((double)ns / opBatch);
+	}
+	perf.Stop(counts);
+	if (found != samples.size() * opBatch) {
+		fprintf(stderr, "GetValueStr missed %lu keys : %s\n", (unsigned long)(samples.size() * opBatch - found), CaseName("get", c).c_str());
+	}
+	results.push_back(MakeResult("get", c, "op", samples, samples.size() * opBatch * 1e9 / total, counts, samples.size() * opBatch));
+
+	samples.clear();
+	total = 0;
+	perf.Start();
+	for (int i = 0; i + opBatch <= ops; i += opBatch) {
+		const char* v = setVal[(i / opBatch) & 1].c_str();
+		unsigned long long start = NowNs();
+		for (int j = i; j < i + opBatch; j++) {
+			ini.SetValueStr(sects[picks[j*2]].c_str(), keys[picks[j*2+1]].c_str(), v);
+		}
+		unsigned long long ns = NowNs() - start;
+		total += ns;
+		samples.push_back((double)ns / opBatch);
+	}
+	perf.Stop(counts);
+	results.push_back(MakeResult("set", c, "op", samples, samples.size() * opBatch * 1e9 / total, counts, samples.size() * opBatch));
+
+	samples.clear();
+	total = 0;
+	size_t length = 0;
+	perf.Start();
+	for (int r = 0; r < reps; r++) {
+		unsigned long long start = NowNs();
+		Ini::SectionRange range = ini.Sections();
+		for (Ini::SectionRange::const_iterator sect = range.begin(); sect != range.end(); sect++) {
+			Ini::ItemRange items = Ini::Items(*sect);
+			for (Ini::ItemRange::const_iterator item = items.begin(); item != items.end(); item++) {
+				length += item->valLen;
+			}
+		}
+		unsigned long long ns = NowNs() - start;
+		total += ns;
+		samples.push_back((double)ns);
+	}
+	perf.Stop(counts);
+	if (length != (size_t)(items * reps * c.valueSize)) {
+		fprintf(stderr, "Iteration missed items : %s\n", CaseName("iterate", c).c_str());
+	}
+	results.push_back(MakeResult("iterate", c, "pass", samples, items * reps * 1e9 / total, counts, items * reps));
+}
+
+static std::string
+ToJson(const Result& r)
+{
+	char line[512];
+	snprintf(line, sizeof(line),
+		"{\"name\":\"%s\",\"op\":\"%s\",\"sections\":%d,\"items\":%d,\"value_size\":%d,\"sorted\":%s,\"crc\":%s,"
+		"\"sample\":\"%s\",\"count\":%lu,\"ops_per_sec\":%.1f,\"p50_ns\":%.1f,\"p99_ns\":%.1f",
+		r.name.c_str(), r.op, r.c.sections, r.c.items, r.c.valueSize, r.c.sorted ? "true" : "false", r.c.crc ? "true" : "false",
+		r.sample, (unsigned long)r.count, r.opsPerSec, r.p50Ns, r.p99Ns);
+	std::string json = line;
+	for (int i = 0; i < PerfCount; i++) {
+		if (r.perf[i] >= 0) {
+			snprintf(line, sizeof(line), ",\"%s_per_op\":%.3f", perfNames[i], r.perf[i]);
+			json += line;
+		}
+	}
+	return json + "}";
+}
+
+static bool
+WriteJson(const char* path, const std::vector<Result>& results)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "fopen : %s (%s)\n", path, strerror(errno));
+		return false;
+	}
+	fprintf(file, "{\"benchmarks\":[\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		fprintf(file, "%s%s\n", ToJson(results[i]).c_str(), i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	fclose(file);
+	return true;
+}
+
+//Reads the ops_per_sec of each name from a file written by WriteJson.
+static bool
+ReadBaseline(const char* path, std::vector<std::pair<std::string, double> >& baseline)
+{
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "fopen : %s (%s)\n", path, strerror(errno));
+		return false;
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		const char* name = strstr(line, "\"name\":\"");
+		const char* opsPerSec = strstr(line, "\"ops_per_sec\":");
+		if (name == NULL || opsPerSec == NULL) {
+			continue;
+		}
+		name += strlen("\"name\":\"");
+		const char* nameEnd = strchr(name, '"');
+		if (nameEnd == NULL) {
+			continue;
+		}
+		baseline.push_back(make_pair(std::string(name, nameEnd - name), strtod(opsPerSec + strlen("\"ops_per_sec\":"), NULL)));
+	}
+	fclose(file);
+	return true;
+}
+
+static int
+CompareBaseline(const std::vector<Result>& results, const std::vector<std::pair<std::string, double> >& baseline, double threshold)
+{
+	int regressions = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		for (size_t b = 0; b < baseline.size(); b++) {
+			if (baseline[b].first != results[i].name || baseline[b].second <= 0) {
+				continue;
+			}
+			double change = (results[i].opsPerSec / baseline[b].second - 1) * 100;
+			bool regressed = change < -threshold;
+			printf("%-40s %+7.1f%%%s\n", results[i].name.c_str(), change, regressed ? "  REGRESSION" : "");
+			regressions += regressed;
+			break;
+		}
+	}
+	return regressions;
+}
+
+static std::vector<int>
+ParseList(const char* s)
+{
+	std::vector<int> list;
+	while (s && *s) {
+		char* end;
+		long n = strtol(s, &end, 10);
+		if (end == s) {
+			break;
+		}
+		if (n > 0) {
+			list.push_back((int)n);
+		}
+		s = *end == ',' ? end + 1 : end;
+	}
+	return list;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<int> sectionCounts = ParseList("10,100");
+	std::vector<int> itemCounts = ParseList("100,1000");
+	std::vector<int> valueSizes = ParseList("16,256");
+	int reps = 5;
+	int ops = 100000;
+	const char* jsonPath = NULL;
+	const char* baselinePath = NULL;
+	double threshold = 10;
+	PerfCounters perf;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if (!strcmp(arg, "--perf")) {
+			if (perf.Open() == 0) {
+				fprintf(stderr, "No hardware counter is available, see /proc/sys/kernel/perf_event_paranoid\n");
+			}
+			continue;
+		}
+		const char* next = i + 1 < argc ? argv[i + 1] : NULL;
+		if (next == NULL) {
+			fprintf(stderr, "Missing value of %s\n", arg);
+			return 2;
+		}
+		if (!strcmp(arg, "--sections")) {
+			sectionCounts = ParseList(next);
+		} else if (!strcmp(arg, "--items")) {
+			itemCounts = ParseList(next);
+		} else if (!strcmp(arg, "--value-size")) {
+			valueSizes = ParseList(next);
+		} else if (!strcmp(arg, "--reps")) {
+			reps = max(1, atoi(next));
+		} else if (!strcmp(arg, "--ops")) {
+			ops = max(opBatch, atoi(next));
+		} else if (!strcmp(arg, "--json")) {
+			jsonPath = next;
+		} else if (!strcmp(arg, "--baseline")) {
+			baselinePath = next;
+		} else if (!strcmp(arg, "--threshold")) {
+			threshold = atof(next);
+		} else {
+			fprintf(stderr, "Unknown option : %s\n", arg);
+			return 2;
+		}
+		i++;
+	}
+
+	Ini::SetLogLevel(Ini::Error);
+	std::vector<Result> results;
+	for (size_t s = 0; s < sectionCounts.size(); s++) {
+		for (size_t i = 0; i < itemCounts.size(); i++) {
+			for (size_t v = 0; v < valueSizes.size(); v++) {
+				for (int sorted = 1; sorted >= 0; sorted--) {
+					for (int crc = 1; crc >= 0; crc--) {
+						Case c = { sectionCounts[s], itemCounts[i], valueSizes[v], sorted != 0, crc != 0 };
+						size_t first = results.size();
+						RunCase(c, reps, ops, perf, results);
+						for (size_t r = first; r < results.size(); r++) {
+							printf("%-40s %14.0f items/s  p50 %12.0f ns  p99 %12.0f ns (per %s)\n", results[r].name.c_str(),
+								results[r].opsPerSec, results[r].p50Ns, results[r].p99Ns, results[r].sample);
+							bool counted = false;
+							for (int p = 0; p < PerfCount; p++) {
+								if (results[r].perf[p] >= 0) {
+									printf("    %s/op %.2f", perfNames[p], results[r].perf[p]);
+									counted = true;
+								}
+							}
+							if (results[r].perf[PerfCycles] > 0 && results[r].perf[PerfInstructions] >= 0) {
+								printf("    ipc %.2f", results[r].perf[PerfInstructions] / results[r].perf[PerfCycles]);
+							}
+							if (counted) {
+								printf("\n");
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	remove("bench-input.ini");
+
+	if (jsonPath && !WriteJson(jsonPath, results)) {
+		return 2;
+	}
+	if (baselinePath) {
+		std::vector<std::pair<std::string, double> > baseline;
+		if (!ReadBaseline(baselinePath, baseline)) {
+			return 2;
+		}
+		int regressions = CompareBaseline(results, baseline, threshold);
+		printf("%d regressions over %.1f%% against %s\n", regressions, threshold, baselinePath);
+		return regressions ? 1 : 0;
+	}
+	return 0;
+}
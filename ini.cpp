@@ -81,15 +81,22 @@
  TBD.
  * Hash sections and keys and reuse it if new one is already in the string pool.
  * Lightweight mode : Don't allocate the memory for all contents, just index the ini file contents and search it. 
- * Set debug function of the caller.
  * Employ TDD.
  * Partially read, partially update the value, but concerning lower speed. 
 */
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdarg.h>
+#if defined(WIN32) || defined(__MINGW32__) || defined(__CYGWIN__)
 #include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <assert.h>
+#include <ctype.h>
+#if !defined(WIN32)
+#include <dirent.h>
+#endif
 
 #if defined WIN32
 #include <winsock.h> //for htonl function.
@@ -102,7 +109,33 @@
 #include <arpa/inet.h> //for htonl function.
 #endif
 
+#if defined __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+//io_uring for the LoadFileAsync, SaveFileAsync. Define INI_NO_IO_URING to use the blocking I/O on the I/O threads.
+#if defined(__linux__) && !defined(INI_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define INI_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#endif
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <new>
 
 #include "ini.h"
 
@@ -121,6 +154,7 @@ using namespace std;
 static const unsigned char crcHeaderSig[4] = {'C','R','C','='};
 static const int crc32StrSize = 4*2;//string format like '00ABCDEF'
 static const int crcHeaderSize = sizeof(crcHeaderSig) + crc32StrSize + EOL_LEN;
+static const size_t crcBlockSize = 16*1024; //taken ahead of the parser, fits in the L1 cache
 
 //hexstr output is like 00ABCD..
 //hexstr length shall be sizebin * 2
@@ -154,6 +188,140 @@ BinToHexStr(void* bin, size_t sizebin, char* hexstr, size_t sizehex)
 
 int Ini::logLevel = Normal;
 
+static Ini::LogFunc logFunc = NULL;
+static void* logContext = NULL;
+
+static void
+WriteLog(int level, const char* msg)
+{
+	if (logFunc) {
+		logFunc(level, msg, logContext);
+	} else {
+		fputs(msg, stdout);
+	}
+}
+
+//Bounded lock free queue of the formatted log messages.
+//Any thread pushes, the drain thread writes them to the log function.
+//A full queue drops the message rather than blocking the caller.
+class AsyncLog
+{
+	struct Slot
+	{
+		std::atomic<size_t> seq;
+		int level;
+		char msg[512];
+	};
+	Slot* slots;
+	size_t mask;
+	std::atomic<size_t> head; //next slot to push
+	size_t tail; //next slot to drain, drain thread only
+	std::atomic<bool> running;
+	std::atomic<unsigned long> dropped;
+	std::thread drainer;
+
+	bool Pop()
+	{
+		Slot& slot = slots[tail & mask];
+		if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+			return false;
+		}
+		WriteLog(slot.level, slot.msg);
+		slot.seq.store(tail + mask + 1, std::memory_order_release);
+		tail++;
+		return true;
+	}
+	void Drain()
+	{
+		int idle = 0;
+		while (running.load(std::memory_order_acquire)) {
+			if (Pop()) {
+				idle = 0;
+			} else if (++idle < 100) {
+				std::this_thread::yield();
+			} else {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+public:
+	AsyncLog() : slots(NULL), mask(0), head(0), tail(0), running(false), dropped(0) {}
+	~AsyncLog() { Stop(); delete[] slots; }
+	bool IsRunning() const { return running.load(std::memory_order_relaxed); }
+
+	bool Start(size_t capacity)
+	{
+		if (IsRunning()) {
+			return true;
+		}
+		//Allocated once and kept, a late Push may still be running after the Stop.
+		if (slots == NULL) {
+			size_t size = 2;
+			while (size < capacity) {
+				size <<= 1;
+			}
+			slots = new(std::nothrow) Slot[size];
+			if (slots == NULL) {
+				return false;
+			}
+			for (size_t i = 0; i < size; i++) {
+				slots[i].seq.store(i, std::memory_order_relaxed);
+			}
+			mask = size - 1;
+			head.store(0);
+			tail = 0;
+		}
+		dropped.store(0);
+		running.store(true, std::memory_order_release);
+		drainer = std::thread(&AsyncLog::Drain, this);
+		return true;
+	}
+
+	void Stop()
+	{
+		if (!IsRunning()) {
+			return;
+		}
+		running.store(false, std::memory_order_release);
+		drainer.join();
+		while (Pop()) {
+		}
+		if (dropped.load()) {
+			char msg[100];
+			snprintf(msg, sizeof(msg), "%s[INI]%lu log messages dropped\n", Ini::GetTimeStamp(), dropped.load());
+			WriteLog(Ini::Error, msg);
+		}
+	}
+
+	void Push(int level, const char* fmt, va_list argList)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		for (;;) {
+			Slot& slot = slots[pos & mask];
+			size_t seq = slot.seq.load(std::memory_order_acquire);
+			if (seq == pos) {
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (seq < pos) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+		Slot& slot = slots[pos & mask];
+		slot.level = level;
+		vsnprintf(slot.msg, sizeof(slot.msg), fmt, argList);
+		slot.seq.store(pos + 1, std::memory_order_release);
+	}
+};
+
+static AsyncLog asyncLog;
+
+//Last error logged by the thread, for the IniLoader results.
+static thread_local char lastError[256];
+
 void
 Ini::Dprintf(int level, const char* fmt, ...)
 {
@@ -162,10 +330,303 @@ Ini::Dprintf(int level, const char* fmt, ...)
 	}
 	va_list argList;
 	va_start(argList,fmt);
-	vfprintf(stdout,fmt,argList);
+	if (level >= Error) {
+		va_list errorArgs;
+		va_copy(errorArgs, argList);
+		vsnprintf(lastError, sizeof(lastError), fmt, errorArgs);
+		va_end(errorArgs);
+	}
+	if (asyncLog.IsRunning()) {
+		asyncLog.Push(level, fmt, argList);
+	} else if (logFunc) {
+		char msg[512];
+		vsnprintf(msg, sizeof(msg), fmt, argList);
+		logFunc(level, msg, logContext);
+	} else {
+		vfprintf(stdout,fmt,argList);
+	}
 	va_end(argList);
 }
 
+//Log function of the caller, NULL to print to the stdout. Set it before logging from the threads.
+void
+Ini::SetLogFunc(LogFunc func, void* context)
+{
+	logFunc = func;
+	logContext = context;
+}
+
+//Queue the logs and write them from a background thread, so the caller never waits for the output.
+//The capacity is fixed by the first start.
+bool
+Ini::StartAsyncLog(size_t capacity)
+{
+	return asyncLog.Start(capacity);
+}
+
+//Writes the queued logs and stops the background thread.
+void
+Ini::StopAsyncLog()
+{
+	asyncLog.Stop();
+}
+
+//Statistics of a thread. Only the owner thread writes it, so a relaxed load and store is enough to count.
+//When the thread exits, its counts are folded into the retired block and the block is reused by a new thread.
+struct StatsBlock
+{
+	std::atomic<unsigned long long> counters[Ini::StatCounterCount];
+	struct {
+		std::atomic<unsigned long long> count;
+		std::atomic<unsigned long long> totalNs;
+		std::atomic<unsigned long long> buckets[Ini::statBucketCount];
+	} timers[Ini::StatTimerCount];
+
+	StatsBlock() { Reset(); }
+	void Reset()
+	{
+		for (int c = 0; c < Ini::StatCounterCount; c++) {
+			counters[c].store(0, memory_order_relaxed);
+		}
+		for (int t = 0; t < Ini::StatTimerCount; t++) {
+			timers[t].count.store(0, memory_order_relaxed);
+			timers[t].totalNs.store(0, memory_order_relaxed);
+			for (int b = 0; b < Ini::statBucketCount; b++) {
+				timers[t].buckets[b].store(0, memory_order_relaxed);
+			}
+		}
+	}
+	void Add(const StatsBlock& from)
+	{
+		for (int c = 0; c < Ini::StatCounterCount; c++) {
+			counters[c].fetch_add(from.counters[c].load(memory_order_relaxed), memory_order_relaxed);
+		}
+		for (int t = 0; t < Ini::StatTimerCount; t++) {
+			timers[t].count.fetch_add(from.timers[t].count.load(memory_order_relaxed), memory_order_relaxed);
+			timers[t].totalNs.fetch_add(from.timers[t].totalNs.load(memory_order_relaxed), memory_order_relaxed);
+			for (int b = 0; b < Ini::statBucketCount; b++) {
+				timers[t].buckets[b].fetch_add(from.timers[t].buckets[b].load(memory_order_relaxed), memory_order_relaxed);
+			}
+		}
+	}
+};
+
+static std::atomic<bool> statsEnabled(false);
+static RWLock statsLock;
+//Never destroyed, the threads may still count while the process exits.
+static std::vector<StatsBlock*>& statsBlocks = *new std::vector<StatsBlock*>(); //of the running threads
+static std::vector<StatsBlock*>& freeStatsBlocks = *new std::vector<StatsBlock*>();
+static StatsBlock& retiredStats = *new StatsBlock(); //counts of the finished threads
+
+//Only the own thread writes its block, but the retiredStats is shared by the exiting threads.
+static inline void
+StatInc(StatsBlock* block, std::atomic<unsigned long long>& counter, unsigned long long n)
+{
+	if (block == &retiredStats) {
+		counter.fetch_add(n, memory_order_relaxed);
+	} else {
+		counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+	}
+}
+
+//Hands the block of the thread back when the thread exits.
+struct StatsBlockHolder
+{
+	StatsBlock* block;
+
+	StatsBlockHolder() : block(NULL) {}
+	~StatsBlockHolder();
+};
+
+//Set once the holder is gone, trivially destructible so it is still valid then.
+static thread_local bool statsThreadExited = false;
+
+StatsBlockHolder::~StatsBlockHolder()
+{
+	statsThreadExited = true;
+	if (block == NULL) {
+		return;
+	}
+	RWLock::Guard guard(statsLock);
+	retiredStats.Add(*block);
+	block->Reset();
+	statsBlocks.erase(std::find(statsBlocks.begin(), statsBlocks.end(), block));
+	try {
+		freeStatsBlocks.push_back(block);
+	} catch (const std::bad_alloc&) {
+		delete block;
+	}
+	block = NULL;
+}
+
+static StatsBlock*
+GetStatsBlock()
+{
+	static thread_local StatsBlockHolder holder;
+	if (statsThreadExited) {
+		//Counted by the destructors of the other thread locals, added atomically by the StatInc.
+		return &retiredStats;
+	}
+	if (holder.block == NULL) {
+		RWLock::Guard guard(statsLock);
+		StatsBlock* block;
+		if (freeStatsBlocks.empty()) {
+			block = new StatsBlock();
+		} else {
+			block = freeStatsBlocks.back();
+			freeStatsBlocks.pop_back();
+		}
+		statsBlocks.push_back(block);
+		holder.block = block;
+	}
+	return holder.block;
+}
+
+static inline void
+StatAdd(Ini::StatCounter counter, unsigned long long n = 1)
+{
+	if (statsEnabled.load(memory_order_relaxed)) {
+		StatsBlock* block = GetStatsBlock();
+		StatInc(block, block->counters[counter], n);
+	}
+}
+
+static inline unsigned long long
+StatNowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Start time of the StatTime, 0 if the statistics are off.
+static inline unsigned long long
+StatStart()
+{
+	return statsEnabled.load(memory_order_relaxed) ? StatNowNs() : 0;
+}
+
+static void
+StatTime(Ini::StatTimer timer, unsigned long long start)
+{
+	if (start == 0) {
+		return;
+	}
+	unsigned long long ns = StatNowNs() - start;
+	int bucket = 0;
+	while (bucket < Ini::statBucketCount - 1 && (ns >> bucket)) {
+		bucket++;
+	}
+	StatsBlock* block = GetStatsBlock();
+	StatInc(block, block->timers[timer].count, 1);
+	StatInc(block, block->timers[timer].totalNs, ns);
+	StatInc(block, block->timers[timer].buckets[bucket], 1);
+}
+
+static inline void
+StatLookup(unsigned long long start, bool hit)
+{
+	if (start) {
+		StatAdd(hit ? Ini::StatLookupHit : Ini::StatLookupMiss);
+		StatTime(Ini::StatLookupTime, start);
+	}
+}
+
+void
+Ini::EnableStats(bool enable)
+{
+	statsEnabled.store(enable);
+}
+
+bool
+Ini::IsStatsEnabled()
+{
+	return statsEnabled.load();
+}
+
+void
+Ini::GetStats(Stats& stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	auto add = [&stats](const StatsBlock& block) {
+		for (int c = 0; c < StatCounterCount; c++) {
+			stats.counters[c] += block.counters[c].load(memory_order_relaxed);
+		}
+		for (int t = 0; t < StatTimerCount; t++) {
+			stats.timers[t].count += block.timers[t].count.load(memory_order_relaxed);
+			stats.timers[t].totalNs += block.timers[t].totalNs.load(memory_order_relaxed);
+			for (int b = 0; b < statBucketCount; b++) {
+				stats.timers[t].buckets[b] += block.timers[t].buckets[b].load(memory_order_relaxed);
+			}
+		}
+	};
+	RWLock::SharedGuard guard(statsLock);
+	for (std::vector<StatsBlock*>::iterator block = statsBlocks.begin(); block != statsBlocks.end(); block++) {
+		add(**block);
+	}
+	add(retiredStats);
+}
+
+//Counts made by the running threads during the reset may survive it.
+void
+Ini::ResetStats()
+{
+	RWLock::SharedGuard guard(statsLock);
+	for (std::vector<StatsBlock*>::iterator block = statsBlocks.begin(); block != statsBlocks.end(); block++) {
+		(*block)->Reset();
+	}
+	retiredStats.Reset();
+}
+
+//Upper bound of the bucket holding the percentile (0~100), 0 if nothing is timed.
+unsigned long long
+Ini::Stats::GetPercentileNs(StatTimer timer, double percentile) const
+{
+	const Histogram& h = timers[timer];
+	if (h.count == 0) {
+		return 0;
+	}
+	unsigned long long rank = (unsigned long long)(h.count * percentile / 100.0);
+	if (rank >= h.count) {
+		rank = h.count - 1;
+	}
+	unsigned long long seen = 0;
+	for (int b = 0; b < statBucketCount; b++) {
+		seen += h.buckets[b];
+		if (seen > rank) {
+			return 1ULL << b;
+		}
+	}
+	return 1ULL << (statBucketCount - 1);
+}
+
+//One 'name value...' line per statistic, timers have count, average, p50, p99 in ns.
+std::string
+Ini::DumpStats()
+{
+	static const char* counterNames[StatCounterCount] = {
+		"lookup_hit", "lookup_miss", "pool_grow", "pool_bytes_moved",
+		"file_flush", "file_sync", "bytes_read", "bytes_written", "parse_sort"
+	};
+	static const char* timerNames[StatTimerCount] = {
+		"lookup_ns", "load_read_ns", "load_crc_ns", "load_parse_ns", "save_ns"
+	};
+	Stats stats;
+	GetStats(stats);
+	std::string s;
+	char line[160];
+	for (int c = 0; c < StatCounterCount; c++) {
+		snprintf(line, sizeof(line), "%s %llu\n", counterNames[c], stats.counters[c]);
+		s += line;
+	}
+	for (int t = 0; t < StatTimerCount; t++) {
+		const Stats::Histogram& h = stats.timers[t];
+		snprintf(line, sizeof(line), "%s count=%llu avg=%llu p50=%llu p99=%llu\n", timerNames[t], h.count,
+			h.count ? h.totalNs / h.count : 0ULL,
+			stats.GetPercentileNs((StatTimer)t, 50), stats.GetPercentileNs((StatTimer)t, 99));
+		s += line;
+	}
+	return s;
+}
+
 #ifdef __MINGW32__
 #include <sys/time.h>
 #else
@@ -175,10 +636,11 @@ Ini::Dprintf(int level, const char* fmt, ...)
 const char*
 Ini::GetTimeStamp()
 {
-	static char timeStr[]="[HH:MM:SS.MLS]";
+	//per thread, so the threads never overwrite the time stamp of each other
+	static thread_local char timeStr[]="[HH:MM:SS.MLS]";
 #if defined(WIN32) || defined(__MINGW32__)
 	SYSTEMTIME stNow;
-	static SYSTEMTIME stLast = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	static thread_local SYSTEMTIME stLast = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 	GetSystemTime(&stNow);
 	if (memcmp(&stNow, &stLast, sizeof(SYSTEMTIME))==0) {
 		return timeStr;
@@ -219,9 +681,9 @@ Ini::GetTimeStamp()
 	memcpy(&stLast,&stNow,sizeof(SYSTEMTIME));	
 #else
 	timespec tsNow;	
-	static timespec tsLast = { -1, -1 };
+	static thread_local timespec tsLast = { -1, -1 };
 	tm tmNow;
-	static tm tmLast = { -1,-1,-1,-1,-1,-1,-1,-1,-1 };
+	static thread_local tm tmLast = { -1,-1,-1,-1,-1,-1,-1,-1,-1 };
 
     if( clock_gettime(CLOCK_REALTIME, &tsNow) == -1 ) {
     	perror( "clock_gettime" );
@@ -355,14 +817,46 @@ static const unsigned int cr3tab[] = { /* CRC polynomial 0xedb88320 */
 #define UPDC32(b, c) (cr3tab[((int)c ^ b) & 0xff] ^ ((c >> 8) & 0x00FFFFFF))
 
 //*Fix warning: narrowing conversion of '3134207493u' from 'unsigned int' to 'const long int' inside { } [-Wnarrowing]
-static unsigned int 
-GetCRC32(char *buf, int bufLen)
+#if defined(WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CRC32_SLICING
+//cr3tab advanced by 1 to 7 more zero bytes, to take 8 bytes a step.
+struct CRC32Slices
+{
+	unsigned int tab[8][256];
+	CRC32Slices()
+	{
+		for (int i = 0; i < 256; i++) {
+			tab[0][i] = cr3tab[i];
+		}
+		for (int k = 1; k < 8; k++) {
+			for (int i = 0; i < 256; i++) {
+				tab[k][i] = (tab[k - 1][i] >> 8) ^ cr3tab[tab[k - 1][i] & 0xff];
+			}
+		}
+	}
+};
+#endif
+
+//Continue the CRC32 of the pieces. Start with 0xFFFFFFFF and xor the result with 0xFFFFFFFF.
+static unsigned int
+UpdateCRC32(unsigned int crc, const char *buf, size_t bufLen)
 {
-	unsigned int crc = 0xFFFFFFFFL; // it must be this
-	for(int i=0; i<bufLen; i++) {
+#if defined(CRC32_SLICING)
+	static const CRC32Slices slices;
+	const unsigned int (*t)[256] = slices.tab;
+	for (; 8 <= bufLen; buf += 8, bufLen -= 8) {
+		unsigned int one, two;
+		memcpy(&one, buf, 4);
+		memcpy(&two, buf + 4, 4);
+		one ^= crc;
+		crc = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^ t[5][(one >> 16) & 0xff] ^ t[4][one >> 24]
+			^ t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^ t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+	}
+#endif
+	for(size_t i=0; i<bufLen; i++) {
 		crc = UPDC32(buf[i], crc);
 	}
-	return crc^0xFFFFFFFFL; // do not forget it!
+	return crc;
 }
 
 //<<< End of CRC32
@@ -372,6 +866,7 @@ static bool
 FlushFile(FILE* file)
 {
 #if defined (WIN32) || defined (__CYGWIN__)
+	StatAdd(Ini::StatFileSync);
 	BOOL r = FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(file)));
 	if (!r) {
 		DWORD errorMessageID = ::GetLastError();
@@ -399,6 +894,7 @@ FlushFile(FILE* file)
 	}
 
 	//Flush OS to Physical File System
+	StatAdd(Ini::StatFileSync);
 	int r = fsync(fd);
 	if (r) {
 		LOGE("fsync : %s\n", strerror(errno));
@@ -423,7 +919,7 @@ public:
 
 	FileBuffer(FILE *file, size_t bufsize, const char* name = "")
 	{
-		this->buf	= (char*) malloc(bufsize);
+		this->buf	= (char*) IniAlloc(bufsize);
 		this->size	= bufsize;
 		this->file	= file;
 		this->name  = name;
@@ -431,10 +927,14 @@ public:
 		e = buf + bufsize - 1;
 		crc32 = 0xFFFFFFFFL;
 		err = 0;
+		if (buf == NULL) {
+			LOGE("FileBuffer alloc(%d) : %s\n", bufsize, name);
+			err++;
+		}
 	}
 	~FileBuffer()
 	{
-		free(buf);
+		IniFree(buf);
 		buf = NULL;
 	}
 	inline void 
@@ -471,6 +971,8 @@ public:
 			LOGE("fwrite %d bytes : %s (%s)\n", p-buf, name, strerror(errno));
 			err++;
 		} else {
+			StatAdd(Ini::StatFileFlush);
+			StatAdd(Ini::StatBytesWritten, p-buf);
 			FlushFile(file);
 			LOGD("%s %d bytes flushed : %s\n",__func__,p-buf, name);
 		}
@@ -483,100 +985,396 @@ public:
 	}
 };
 
-Ini::Ini(const int strpoolsize/*=64*1024*/)
+static void*
+MallocAlloc(size_t size, void*)
 {
-	LOGD("%s, poolsize=%d\n", __FUNCTION__, strpoolsize);
-	iniFileName[0] = 0;
+	return malloc(size);
+}
 
-	sects.reserve(100);
-	lastParsedSection = sects.end();
+static void*
+MallocRealloc(void* ptr, size_t size, void*)
+{
+	return realloc(ptr, size);
+}
 
-	strPool = (char*)malloc(strpoolsize);
-	if (strPool) {
-		sizPool = strpoolsize;
-		remPool = strpoolsize;
+static void
+MallocFree(void* ptr, void*)
+{
+	free(ptr);
+}
+
+static IniAllocator iniAllocator = { MallocAlloc, MallocRealloc, MallocFree, NULL };
+
+void
+Ini::SetAllocator(const IniAllocator* newAllocator)
+{
+	if (newAllocator) {
+		iniAllocator = *newAllocator;
+	} else {
+		iniAllocator.alloc = MallocAlloc;
+		iniAllocator.realloc = MallocRealloc;
+		iniAllocator.free = MallocFree;
+		iniAllocator.context = NULL;
 	}
-	posPool = 0;
+}
 
-	contentsChanged = false;
-	//saveChangedFileOnly = false;
-	saveChangedFileOnly = true;
+void*
+IniAlloc(size_t size)
+{
+	return iniAllocator.alloc(size, iniAllocator.context);
 }
 
-Ini::~Ini(void)
+void*
+IniRealloc(void* ptr, size_t size)
 {
-	LOGD("%s\n",__FUNCTION__);	
-	if (strPool) {
-		free(strPool);
-		strPool = NULL;		
-	}
+	return iniAllocator.realloc(ptr, size, iniAllocator.context);
 }
 
 void
-Ini::Reset()
+IniFree(void* ptr)
 {
-	sects.clear();
-	lastParsedSection = sects.end();
-
-	memset(iniFileName,0,sizeof(iniFileName));
-	memset(strPool,0,sizPool);
-	posPool = 0;
-	remPool = sizPool;
+	if (ptr) {
+		iniAllocator.free(ptr, iniAllocator.context);
+	}
 }
 
-// Reallocate strPool when it is out of space.
-const char* 
-Ini::PushString(const char* s) 
+static const size_t arenaAlign = 16;
+
+//Each block is led by its size, which keeps the block aligned.
+struct ArenaHeader
 {
-	size_t room = strlen(s) + 1;
-	if (sizPool < posPool + room) {
-		size_t grow = room + (size_t)(sizPool*0.05);
-		LOGD("String pool is full. Reallocate the string pool. (+%d)\n", grow);
-		char* newPool = (char*)realloc(strPool, sizPool + grow);
-		if (newPool == NULL) {
-			LOGE("Can't push the string to pool : reallocate fail! (%s)\n", strerror(errno));
-			return NULL;
-		}
-		LOGD("String pool reallocated : %x -> %x (size=%d)\n", strPool, newPool, sizPool + grow);
-		if (newPool != strPool) {
-			int offset = newPool - strPool;
-			for (SectionList::iterator sect = sects.begin(); sect != sects.end(); sect++) {
-				if (sect->key) {
-					sect->key += offset;
-				}
-				for (ItemList::iterator item = sect->items.begin(); item != sect->items.end(); item++) {
-					if (item->key) {
-						item->key += offset;
-					}
-					if (item->val) {
-						item->val += offset;
-					}
-				}
-			}
-		}
-		strPool = newPool;
-		sizPool += grow;
-		remPool += grow;
+	size_t room;
+	size_t sizeClass;
+};
+
+//Class of the smallest power of two room holding the size.
+static size_t
+ArenaSizeClass(size_t size)
+{
+	size_t sizeClass = 0;
+	while ((arenaAlign << sizeClass) < size) {
+		sizeClass++;
 	}
-	memcpy(strPool + posPool, s, room);
-	posPool += room;
-	remPool -= room;
-	return strPool + posPool - room;
+	return sizeClass;
 }
 
-bool
-Ini::LoadFile(const char* theFileName, bool checkCRC)
+IniArena::IniArena(void* buf, size_t size)
 {
-	LOGD("%s: %s, checkCRC=%d\n", __FUNCTION__, theFileName, checkCRC);
+	//The front is aligned like the malloc.
+	size_t skip = (arenaAlign - (size_t)buf % arenaAlign) % arenaAlign;
+	this->buf = (char*)buf + min(skip, size);
+	this->size = size - min(skip, size);
+	top = last = used = peak = 0;
+	memset(freeBlocks, 0, sizeof(freeBlocks));
+}
 
-	FILE *file = NULL;
-	char *buf = NULL;
-	bool result = false;
+IniAllocator
+IniArena::GetAllocator()
+{
+	IniAllocator arena = { Alloc, Realloc, Free, this };
+	return arena;
+}
 
-	do {
-		long fileSize = 0;
-		size_t strSize = 0;
+void
+IniArena::Reset()
+{
+	RWLock::Guard guard(lock);
+	top = last = used = 0;
+	memset(freeBlocks, 0, sizeof(freeBlocks));
+}
 
+size_t
+IniArena::GetUsed() const
+{
+	RWLock::SharedGuard guard(lock);
+	return used;
+}
+
+size_t
+IniArena::GetPeak() const
+{
+	RWLock::SharedGuard guard(lock);
+	return peak;
+}
+
+void*
+IniArena::AllocLocked(size_t size)
+{
+	if (size == 0) {
+		return NULL;
+	}
+	size_t sizeClass = ArenaSizeClass(size);
+	if (sizeClass >= (size_t)sizeClasses) {
+		LOGE("%s : out of the arena, %d bytes asked, %d of %d bytes used\n", __FUNCTION__, size, used, this->size);
+		return NULL;
+	}
+	size_t room = arenaAlign << sizeClass;
+	char* block = freeBlocks[sizeClass];
+	if (block) {
+		memcpy(&freeBlocks[sizeClass], block, sizeof(char*));
+		used += room;
+		return block;
+	}
+	if (this->size - top < sizeof(ArenaHeader) + room) {
+		LOGE("%s : out of the arena, %d bytes asked, %d of %d bytes used\n", __FUNCTION__, size, used, this->size);
+		return NULL;
+	}
+	ArenaHeader* header = (ArenaHeader*)(buf + top);
+	header->room = room;
+	header->sizeClass = sizeClass;
+	last = top;
+	top += sizeof(ArenaHeader) + room;
+	used += room;
+	peak = max(peak, top);
+	return header + 1;
+}
+
+void*
+IniArena::Alloc(size_t size, void* context)
+{
+	IniArena* arena = (IniArena*)context;
+	RWLock::Guard guard(arena->lock);
+	return arena->AllocLocked(size);
+}
+
+void*
+IniArena::Realloc(void* ptr, size_t size, void* context)
+{
+	IniArena* arena = (IniArena*)context;
+	RWLock::Guard guard(arena->lock);
+	if (ptr == NULL) {
+		return arena->AllocLocked(size);
+	}
+	ArenaHeader* header = (ArenaHeader*)ptr - 1;
+	if (size <= header->room) {
+		return ptr;
+	}
+	size_t sizeClass = ArenaSizeClass(size);
+	if ((char*)header - arena->buf == (ptrdiff_t)arena->last && sizeClass < (size_t)sizeClasses) {
+		size_t room = arenaAlign << sizeClass;
+		if (arena->size - arena->last - sizeof(ArenaHeader) >= room) {
+			arena->used += room - header->room;
+			arena->top = arena->last + sizeof(ArenaHeader) + room;
+			arena->peak = max(arena->peak, arena->top);
+			header->room = room;
+			header->sizeClass = sizeClass;
+			return ptr;
+		}
+	}
+	void* moved = arena->AllocLocked(size);
+	if (moved) {
+		memcpy(moved, ptr, header->room);
+		arena->FreeLocked(ptr);
+	}
+	return moved;
+}
+
+//The last block goes back to the top, the others to the free list of their class.
+void
+IniArena::FreeLocked(void* ptr)
+{
+	ArenaHeader* header = (ArenaHeader*)ptr - 1;
+	used -= header->room;
+	if ((char*)header - buf == (ptrdiff_t)last) {
+		top = last;
+		return;
+	}
+	memcpy(ptr, &freeBlocks[header->sizeClass], sizeof(char*));
+	freeBlocks[header->sizeClass] = (char*)ptr;
+}
+
+void
+IniArena::Free(void* ptr, void* context)
+{
+	IniArena* arena = (IniArena*)context;
+	RWLock::Guard guard(arena->lock);
+	arena->FreeLocked(ptr);
+}
+
+Ini::Ini(const int strpoolsize/*=64*1024*/)
+{
+	LOGD("%s, poolsize=%d\n", __FUNCTION__, strpoolsize);
+	iniFileName[0] = 0;
+
+	try {
+		sects.reserve(100);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory for the sections\n", __FUNCTION__);
+	}
+	lastParsedSection = sects.end();
+
+	strPool = (char*)IniAlloc(strpoolsize);
+	if (strPool) {
+		sizPool = strpoolsize;
+		remPool = strpoolsize;
+	} else {
+		LOGE("%s : out of memory for the string pool (%d)\n", __FUNCTION__, strpoolsize);
+		sizPool = 0;
+		remPool = 0;
+	}
+	posPool = 0;
+
+	contentsChanged = false;
+	//saveChangedFileOnly = false;
+	saveChangedFileOnly = true;
+	pinPool = false;
+	published = NULL;
+	multiValueKeys = false;
+	multiValueDelim = ',';
+	adoptFrom = adoptTo = NULL;
+	publishedVersion = 0;
+	batchDepth = 0;
+	nextSubscriptionId = 1;
+	dispatching = false;
+	fileSize = -1;
+	fileMTime = 0;
+	fileMTimeNsec = 0;
+	fileCRC[0] = 0;
+}
+
+Ini::~Ini(void)
+{
+	LOGD("%s\n",__FUNCTION__);	
+	FreePoolChunks();
+	if (strPool) {
+		IniFree(strPool);
+		strPool = NULL;		
+	}
+	//No reader is left, the snapshots themselves live while they are held.
+	delete published.load();
+	for (size_t i = 0; i < retiredSnapshots.size(); i++) {
+		delete retiredSnapshots[i];
+	}
+}
+
+void
+Ini::FreePoolChunks()
+{
+	for (PoolChunkList::iterator chunk = poolChunks.begin(); chunk != poolChunks.end(); chunk++) {
+		IniFree(*chunk);
+	}
+	poolChunks.clear();
+}
+
+void
+Ini::Reset()
+{
+	BatchGuard batch(*this);
+	if (!subscriptions.empty()) {
+		for (SectionList::iterator sect = sects.begin(); sect != sects.end(); sect++) {
+			Changed(sect->key, NULL, 0);
+		}
+	}
+	sects.clear();
+	lastParsedSection = sects.end();
+	valueIndexes.clear();
+
+	ClearFileStamp();
+	FreePoolChunks();
+	if (strPool) {
+		memset(strPool,0,sizPool);
+	}
+	posPool = 0;
+	remPool = sizPool;
+}
+
+size_t
+Ini::GetPoolRoom()
+{
+	return remPool;
+}
+
+// Reallocate strPool when it is out of space.
+// Returns the free tail of the pool having at least room bytes, but it is not committed yet.
+char*
+Ini::ReservePool(size_t room)
+{
+	if (sizPool < posPool + room && pinPool) {
+		// Chain a new chunk instead of moving the pool, handed out strings stay where they are.
+		size_t newSize = max(sizPool, room);
+		LOGD("String pool is full. Allocate a new chunk. (%d)\n", newSize);
+		char* newPool = (char*)IniAlloc(newSize);
+		if (newPool == NULL) {
+			LOGE("Can't push the string to pool : allocate fail! (%s)\n", strerror(errno));
+			return NULL;
+		}
+		try {
+			poolChunks.push_back(strPool);
+		} catch (const std::bad_alloc&) {
+			LOGE("Can't push the string to pool : allocate fail!\n");
+			IniFree(newPool);
+			return NULL;
+		}
+		StatAdd(Ini::StatPoolGrow);
+		strPool = newPool;
+		sizPool = newSize;
+		remPool = newSize;
+		posPool = 0;
+	}
+	if (sizPool < posPool + room) {
+		size_t grow = room + (size_t)(sizPool*0.05);
+		LOGD("String pool is full. Reallocate the string pool. (+%d)\n", grow);
+		char* newPool = (char*)IniRealloc(strPool, sizPool + grow);
+		if (newPool == NULL) {
+			LOGE("Can't push the string to pool : reallocate fail! (%s)\n", strerror(errno));
+			return NULL;
+		}
+		LOGD("String pool reallocated : %x -> %x (size=%d)\n", strPool, newPool, sizPool + grow);
+		StatAdd(Ini::StatPoolGrow);
+		if (newPool != strPool) {
+			StatAdd(Ini::StatPoolBytesMoved, posPool);
+			//Strings in the adopted chunks stay.
+			ptrdiff_t offset = newPool - strPool;
+			const char* from = strPool;
+			const char* to = strPool + posPool;
+			for (SectionList::iterator sect = sects.begin(); sect != sects.end(); sect++) {
+				if (from <= sect->key && sect->key < to) {
+					sect->key += offset;
+				}
+				for (ItemList::iterator item = sect->items.begin(); item != sect->items.end(); item++) {
+					if (from <= item->key && item->key < to) {
+						item->key += offset;
+					}
+					if (from <= item->val && item->val < to) {
+						item->val += offset;
+					}
+				}
+			}
+		}
+		strPool = newPool;
+		sizPool += grow;
+		remPool += grow;
+	}
+	return strPool + posPool;
+}
+
+const char* 
+Ini::PushString(const char* s) 
+{
+	//The tokens of the adopted buffer are terminated in place already.
+	if (adoptFrom <= s && s < adoptTo) {
+		return s;
+	}
+	size_t room = strlen(s) + 1;
+	char* dst = ReservePool(room);
+	if (dst == NULL) {
+		return NULL;
+	}
+	memcpy(dst, s, room);
+	posPool += room;
+	remPool -= room;
+	return dst;
+}
+
+//Read the whole file into a buffer by the IniAlloc terminated by 0, NULL on error.
+char*
+Ini::ReadFile(const char* theFileName, size_t& fileSize)
+{
+	FILE *file = NULL;
+	char *buf = NULL;
+	bool result = false;
+
+	do {
 		file = fopen(theFileName, "rb");
 		if (file==NULL) {
 			LOGE("fopen : %s (%s)\n",theFileName,strerror(errno));
@@ -588,44 +1386,85 @@ Ini::LoadFile(const char* theFileName, bool checkCRC)
 			break;
 		}
 
-		fileSize = ftell(file);
-		if(-1L == fileSize) {
+		long size = ftell(file);
+		if(-1L == size) {
 			LOGE("ftell : %s (%s)\n",theFileName,strerror(errno));
 			break;	
 		}
-		LOGD("fileSize=%d\n",fileSize);
+		LOGD("fileSize=%d\n",size);
 
 		if( -1 == fseek(file, 0L, SEEK_SET) ) {
 			LOGE("fseek SEEK_SET : %s (%s)\n",theFileName,strerror(errno));
 			break;
 		}
 
-		strSize = fileSize;
-
-		buf = (char*)malloc(fileSize+1);
+		buf = (char*)IniAlloc(size+1);
 		if (!buf) {
-			LOGE("malloc(%d) : %s\n",fileSize,theFileName);
+			LOGE("alloc(%d) : %s\n",size,theFileName);
 			break;
 		}
 
 		int fread_res = 0;
-		if ((fread_res=fread(buf,1,fileSize,file))!=fileSize) {
+		if ((fread_res=fread(buf,1,size,file))!=size) {
 			LOGE("fread return %d : %s (%s)\n",fread_res,theFileName,strerror(errno));
 			break;
 		}
 
-		*(buf + fileSize) = 0;
+		*(buf + size) = 0;
+		fileSize = size;
+		StatAdd(StatBytesRead, size);
+		result = true;
+	} while(0);
+	if (file) fclose(file);
+	if (!result && buf) {
+		IniFree(buf);
+		buf = NULL;
+	}
+	return buf;
+}
+
+bool
+Ini::LoadFile(const char* theFileName, bool checkCRC)
+{
+	LOGD("%s: %s, checkCRC=%d\n", __FUNCTION__, theFileName, checkCRC);
+
+	unsigned long long statStart = StatStart();
+	size_t fileSize = 0;
+	char* buf = ReadFile(theFileName, fileSize);
+	if (buf == NULL) {
+		return false;
+	}
+	StatTime(StatLoadReadTime, statStart);
+
+	return LoadBuffer(theFileName, buf, fileSize, checkCRC, NULL, NULL, true);
+}
 
+//Parse the contents of the file read into the buf, which is terminated by 0 at the bufLen and touched by the parser.
+//bodyCRC is the CRC32 already calculated after the CRC header, NULL to calculate it here.
+//phaseNs gets the CRC check and the parse times if not NULL.
+//With adopt, the buf allocated by the IniAlloc is taken, loaded or not, and the items point into it in place.
+bool
+Ini::LoadBuffer(const char* theFileName, char* buf, size_t bufLen, bool checkCRC, const unsigned int* bodyCRC, unsigned long long* phaseNs, bool adopt)
+{
+	unsigned long long statStart = StatStart();
+	unsigned long long phaseStart = phaseNs ? StatNowNs() : 0;
+	size_t strSize = bufLen;
+	bool result = false;
+	char* own = adopt ? buf : NULL; //until it is handed to the parser
+	char crc32str[crc32StrSize + 1] = { 0 };
+	do {
 		bool haveCRC = false;
-		if (crcHeaderSize < fileSize && memcmp(buf, crcHeaderSig, sizeof(crcHeaderSig))==0) {
+		bool fused = false; //the CRC is checked by the parser
+		unsigned int crc32 = 0;
+		if ((size_t)crcHeaderSize < strSize && memcmp(buf, crcHeaderSig, sizeof(crcHeaderSig))==0) {
 			haveCRC = true;
+			memcpy(crc32str, buf + sizeof(crcHeaderSig), crc32StrSize);
 			if (checkCRC) {
-				char crc32str[crc32StrSize + 1] = { 0 };
-				unsigned int crc32;
-				memcpy(&crc32str,buf+sizeof(crcHeaderSig),crc32StrSize);
 				HexStringToByteArray(crc32str, (unsigned char*)&crc32, sizeof(crc32));
 				crc32 = ntohl(crc32);
-				if (crc32!=GetCRC32(buf+crcHeaderSize,strSize-crcHeaderSize)) {
+				if (bodyCRC == NULL) {
+					fused = true;
+				} else if (crc32 != *bodyCRC) {
 					LOGE("CRC checksum fail. broken file : %s\n",theFileName);
 					break;
 				}
@@ -636,27 +1475,98 @@ Ini::LoadFile(const char* theFileName, bool checkCRC)
 			LOGE("No CRC checksum! : %s\n", theFileName);
 			break;
 		}
+		StatTime(StatLoadCRCTime, statStart);
+		statStart = StatStart();
+		if (phaseNs) {
+			unsigned long long now = StatNowNs();
+			phaseNs[0] = now - phaseStart;
+			phaseStart = now;
+		}
 
-		Reset();
+		//Subscribers get the differences from the FromString, don't drop everything here.
+		if (subscriptions.empty() && !fused) {
+			Reset();
+		}
 
-		if (haveCRC) {
-			if (!FromString(buf + crcHeaderSize, strSize - crcHeaderSize, true)) {
+		char* parserOwn = own;
+		own = NULL;
+		if (fused) {
+			if (!ParseChecked(theFileName, buf + crcHeaderSize, strSize - crcHeaderSize, crc32, parserOwn)) {
+				break;
+			}
+		} else if (haveCRC) {
+			if (!FromBuffer(buf + crcHeaderSize, strSize - crcHeaderSize, true, parserOwn)) {
 				break;
 			}
 		} else {
-			if (!FromString(buf, strSize, false)) {
+			if (!FromBuffer(buf, strSize, false, parserOwn)) {
 				break;
 			}
 		}
+		StatTime(StatLoadParseTime, statStart);
+		if (phaseNs) {
+			phaseNs[1] = StatNowNs() - phaseStart;
+		}
 
 		SetFileName(theFileName);
+		UpdateFileStamp(haveCRC ? crc32str : NULL);
 		result = true;
 	} while(0);
-	if (buf)  free(buf);
-	if (file) fclose(file);
+	IniFree(own);
 	return result;
 }
 
+//Parse and check the CRC in one pass. Built aside and taken only if the CRC matches, so a broken file
+//leaves the contents as they were. An empty Ini is parsed into directly and reset on the mismatch.
+bool
+Ini::ParseChecked(const char* theFileName, const char* buf, size_t bufLen, unsigned int expected, char* own)
+{
+	unsigned int crc = 0;
+	if (sects.empty() && subscriptions.empty()) {
+		if (!Parse(buf, bufLen, true, &crc, own)) {
+			return false;
+		}
+		if (crc != expected) {
+			LOGE("CRC checksum fail. broken file : %s\n",theFileName);
+			Reset();
+			return false;
+		}
+		return true;
+	}
+	//The tokens fit in the size of the buf, if they are not adopted in place.
+	Ini staged(own ? 1024 : bufLen + 1);
+	staged.SetMultiValueKeys(multiValueKeys, multiValueDelim);
+	if (!staged.Parse(buf, bufLen, true, &crc, own)) {
+		return false;
+	}
+	if (crc != expected) {
+		LOGE("CRC checksum fail. broken file : %s\n",theFileName);
+		return false;
+	}
+	if (!subscriptions.empty()) {
+		return ApplyFrom(staged) >= 0;
+	}
+	TakeContents(staged);
+	return true;
+}
+
+//Swap the sections and the pool with the from, which gets the old ones to free.
+void
+Ini::TakeContents(Ini& from)
+{
+	valueIndexes.clear();
+	sects.swap(from.sects);
+	poolChunks.swap(from.poolChunks);
+	std::swap(strPool, from.strPool);
+	std::swap(sizPool, from.sizPool);
+	std::swap(remPool, from.remPool);
+	std::swap(posPool, from.posPool);
+	lastParsedSection = sects.end();
+	from.lastParsedSection = from.sects.end();
+	contentsChanged |= from.contentsChanged;
+}
+
+//Streams the file through a small buffer, so the memory needed doesn't grow with the file.
 bool
 Ini::ValidateFile(const char* theFileName)
 {
@@ -665,47 +1575,51 @@ Ini::ValidateFile(const char* theFileName)
 		LOGE("fopen : %s (%s)\n", theFileName, strerror(errno));
 		return false;
 	}
-	char* buf = NULL;
+#if defined __linux__
+	posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	const size_t bufSize = 64*1024;
+	char* buf = (char*)IniAlloc(bufSize);
 	bool result = false;
 	do {
-		struct stat fileStat = {0,};
-		if (stat(theFileName, &fileStat)) {
-			LOGE("stat : %s (%s)\n",theFileName,strerror(errno));
+		if (!buf) {
+			LOGE("alloc(%d) : %s\n",bufSize,theFileName);
 			break;
 		}
-		size_t fileSize = fileStat.st_size;
-		size_t strSize = fileStat.st_size;
-		buf = (char*)malloc(fileSize);
-		if (!buf) {
-			LOGE("malloc(%d) : %s\n",fileSize,theFileName);
+		size_t len = fread(buf, 1, crcHeaderSize, file);
+		if (len < (size_t)crcHeaderSize || memcmp(buf, crcHeaderSig, sizeof(crcHeaderSig))) {
+			LOGE("No CRC checksum : %s\n",theFileName);
 			break;
 		}
-		if (fread(buf,fileSize,1,file)!=1) {
+		unsigned int crc32;
+		char crc32str[crc32StrSize + 1] = { 0 };
+		memcpy(&crc32str, buf + sizeof(crcHeaderSig), crc32StrSize);
+		HexStringToByteArray(crc32str, (unsigned char*)&crc32, sizeof(crc32));
+		crc32 = ntohl(crc32);
+
+		unsigned int crc = 0xFFFFFFFF;
+		size_t bodyLen = 0;
+		while ((len = fread(buf, 1, bufSize, file)) > 0) {
+			crc = UpdateCRC32(crc, buf, len);
+			bodyLen += len;
+		}
+		if (ferror(file)) {
 			LOGE("fread : %s (%s)\n",theFileName,strerror(errno));
 			break;
-		}		
-		if (fileSize <= crcHeaderSize) {
+		}
+		StatAdd(StatBytesRead, crcHeaderSize + bodyLen);
+		if (bodyLen == 0) {
 			LOGE("No CRC checksum : %s\n",theFileName);
 			break;
 		}
-		if (memcmp(buf, crcHeaderSig, sizeof(crcHeaderSig))==0) {
-			unsigned int crc32;
-			char crc32str[crc32StrSize + 1] = { 0 };
-			memcpy(&crc32str, buf + sizeof(crcHeaderSig), crc32StrSize);
-			HexStringToByteArray(crc32str, (unsigned char*)&crc32, sizeof(crc32));
-			crc32 = ntohl(crc32);
-			if (crc32 != GetCRC32(buf + crcHeaderSize, strSize - crcHeaderSize)) {
-				LOGE("CRC checksum fail. broken file : %s\n", theFileName);
-				break;
-			}
-		} else {
-			LOGE("No CRC checksum : %s\n",theFileName);
-			break;			
+		if (crc32 != (crc ^ 0xFFFFFFFF)) {
+			LOGE("CRC checksum fail. broken file : %s\n", theFileName);
+			break;
 		}
 		result = true;
 	} while(0);
-	if (file) fclose(file);
-	if (buf) free(buf);
+	fclose(file);
+	IniFree(buf);
 	return result;
 }
 
@@ -733,12 +1647,14 @@ Ini::SaveFile(const char* theFileName, bool writeCRC)
 {
 	const char *fileName = theFileName ? theFileName : iniFileName;
 	bool result = false;
+	char crc32str[crc32StrSize + 1] = { 0 };
 
-	if (saveChangedFileOnly && !contentsChanged && (fileName == iniFileName || 0 == StringNoCaseCompare(fileName, iniFileName, max(strlen(fileName),strlen(iniFileName))))) {
+	if (IsUnchangedSave(fileName)) {
 		LOGN("Contents not changed : %s\n", fileName);
 		return true;
 	}
 
+	unsigned long long statStart = StatStart();
 	LOGD("fopen for write : %s\n", fileName);
 	FILE* file = fopen(fileName, "wb");
 	if (file==NULL) {
@@ -748,6 +1664,9 @@ Ini::SaveFile(const char* theFileName, bool writeCRC)
 
 	do {
 		FileBuffer fb(file, 128*1024, fileName);
+		if (fb.err) {
+			break;
+		}
 		if (writeCRC) {
 			if (fwrite(crcHeaderSig,sizeof(crcHeaderSig),1,file)<1) {
 				LOGE("fwrite crcHeaderSig : %s (%s)\n", fileName, strerror(errno));
@@ -795,12 +1714,12 @@ Ini::SaveFile(const char* theFileName, bool writeCRC)
 			}
 			int crc32le = fb.getCRC32();
 			int crc32be = htonl(crc32le);
-			char crc32str[crc32StrSize + 1] = { 0 };
 			BinToHexStr(&crc32be, sizeof(crc32be), crc32str, sizeof(crc32str));
 			if (fwrite(crc32str,crc32StrSize,1,file)<1) {
 				LOGE("fwrite crc : %s (%s)\n", fileName, strerror(errno));
 				break;
 			}
+			StatAdd(StatBytesWritten, crcHeaderSize);
 		}
 		contentsChanged = false;
 		result = true;
@@ -812,761 +1731,4468 @@ Ini::SaveFile(const char* theFileName, bool writeCRC)
 
 	fclose(file);
 	file = NULL;
+	StatTime(StatSaveTime, statStart);
 
+	//Our own save shall not trigger the ReloadFile.
+	if (result && (fileName == iniFileName || 0 == strcmp(fileName, iniFileName))) {
+		UpdateFileStamp(crc32str);
+	}
 	return result;
 }
 
-void
-Ini::SetFileName(const char* theFileName)
-{
-	snprintf(iniFileName, sizeof(iniFileName), "%s", theFileName);
-}
-
-const char*
-Ini::GetFileName()
-{
-	return iniFileName;
-}
-
-//buf shall be terminated with null character
+//Write the serialized contents like the SaveFile. crc32str gets the CRC if writeCRC.
 bool
-Ini::FromString(const char* buf, size_t buflen, bool sorted)
+Ini::WriteFile(const char* fileName, const char* buf, size_t bufLen, bool writeCRC, char* crc32str)
 {
-	bool result = false;
-
-	Reset();
+	unsigned long long statStart = StatStart();
+	LOGD("fopen for write : %s\n", fileName);
+	FILE* file = fopen(fileName, "wb");
+	if (file==NULL) {
+		LOGE("fopen : %s (%s)\n", fileName, strerror(errno));
+		return false;
+	}
 
+	bool result = false;
 	do {
-		const char *p = buf;
-		const char *e = buf + buflen;
-		const char *sos = NULL; //start of section
-
-		if (!ValidateFormat(buf, buflen)) {
+		const size_t bufSize = 128*1024;
+		FileBuffer fb(file, bufSize, fileName);
+		if (fb.err) {
 			break;
 		}
-
-		while(p<e) {
-			while(p<e && (!*p || *p==' ' || *p=='\r' || *p=='\n' || *p=='\t')) {
-				p++;
+		if (writeCRC) {
+			char header[crcHeaderSize] = { 0 };
+			memcpy(header, crcHeaderSig, sizeof(crcHeaderSig));
+			memcpy(header + sizeof(crcHeaderSig) + crc32StrSize, EOL, EOL_LEN);
+			if (fwrite(header,crcHeaderSize,1,file)<1) {
+				LOGE("fwrite crcHeader : %s (%s)\n", fileName, strerror(errno));
+				break;
 			}
-			if (e <= p) {
+		}
+		//FileBuffer takes less than its size at once.
+		for (size_t pos = 0; pos < bufLen; pos += bufSize/2) {
+			fb.push(buf + pos, min(bufLen - pos, bufSize/2));
+		}
+		fb.flush();
+		if (fb.err) {
+			LOGE("fwrite contents : %s (%s)\n", fileName, strerror(errno));
+			break;
+		}
+		if (writeCRC) {
+			if (fseek(file,sizeof(crcHeaderSig),SEEK_SET)==-1) {
+				LOGE("fseek crcHeaderSig : %s (%s)\n", fileName, strerror(errno));
 				break;
 			}
-			if (*p=='[') {
-				p++;
-				//get sect
-				while(p<e && *p==' ') {
-					p++;
-				}
-				sos = p; //start of section
-				const char *eos = NULL; //end of section
-				while(p<e && *p!='\r' && *p!='\n') {
-					if (*p == ']') {
-						eos = p;
-					}
-					p++;
-				}
-				if (eos) {					
-					while (*(eos-1) == ' ') {
-						eos--;//remove trail blank
-					}
-					*(char*)eos = 0;
-					LOGD("sect(%d)='%s'\n", eos - sos, sos);
-				}
-				continue;
-			} else if (*p==';' || *p=='#') { //Add '#' for the remarks - 160530
-				//remarks
-				while(p<e && *p!='\r' && *p!='\n') {
-					p++;
+			int crc32be = htonl(fb.getCRC32());
+			BinToHexStr(&crc32be, sizeof(crc32be), crc32str, crc32StrSize + 1);
+			if (fwrite(crc32str,crc32StrSize,1,file)<1) {
+				LOGE("fwrite crc : %s (%s)\n", fileName, strerror(errno));
+				break;
+			}
+			StatAdd(StatBytesWritten, crcHeaderSize);
+		}
+		result = FlushFile(file);
+	} while(0);
+
+	fclose(file);
+	StatTime(StatSaveTime, statStart);
+	return result;
+}
+
+//SaveFile of the unchanged contents into the same file does nothing.
+bool
+Ini::IsUnchangedSave(const char* fileName)
+{
+	return saveChangedFileOnly && !contentsChanged && (fileName == iniFileName || 0 == StringNoCaseCompare(fileName, iniFileName, max(strlen(fileName),strlen(iniFileName))));
+}
+
+//Worker threads of the LoadFileAsync and SaveFileAsync.
+//Started by the first job, and joined at the exit after the queued jobs are done.
+class IoWorkers
+{
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<std::function<void()> > jobs;
+	std::vector<std::thread> threads;
+	bool stopping;
+
+	void Run()
+	{
+		unique_lock<mutex> guard(lock);
+		for (;;) {
+			while (jobs.empty() && !stopping) {
+				wake.wait(guard);
+			}
+			if (jobs.empty()) {
+				break;
+			}
+			std::function<void()> job = jobs.front();
+			jobs.pop_front();
+			guard.unlock();
+			job();
+			guard.lock();
+		}
+	}
+public:
+	IoWorkers() : stopping(false) {}
+	~IoWorkers()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < threads.size(); i++) {
+			threads[i].join();
+		}
+	}
+	void Queue(const std::function<void()>& job)
+	{
+		lock_guard<mutex> guard(lock);
+		if (threads.empty()) {
+			unsigned int count = min(max(std::thread::hardware_concurrency(), 1U), 4U);
+			for (unsigned int i = 0; i < count; i++) {
+				threads.push_back(std::thread(&IoWorkers::Run, this));
+			}
+		}
+		jobs.push_back(job);
+		wake.notify_one();
+	}
+};
+
+static IoWorkers ioWorkers;
+
+#ifdef INI_IO_URING
+static const size_t ringChunk = 256*1024;
+static const int ringDepth = 4;
+
+//Minimal io_uring by the raw system calls, one per I/O thread.
+class IoUring
+{
+	int fd;
+	unsigned entries;
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned sqeTail;
+	unsigned submitted;
+
+	IoUring(const IoUring&);
+	IoUring& operator=(const IoUring&);
+	void Exit()
+	{
+		if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+		if (cqRing != MAP_FAILED) munmap(cqRing, cqRingSize);
+		if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+		if (fd != -1) close(fd);
+		sqes = (struct io_uring_sqe*)MAP_FAILED;
+		cqRing = sqRing = MAP_FAILED;
+		fd = -1;
+	}
+public:
+	IoUring() : fd(-1), sqes((struct io_uring_sqe*)MAP_FAILED), sqRing(MAP_FAILED), cqRing(MAP_FAILED) {}
+	~IoUring() { Exit(); }
+
+	//Fails on the kernels without io_uring or without IORING_OP_READ, WRITE (5.6).
+	bool Init(unsigned count)
+	{
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		fd = (int)syscall(__NR_io_uring_setup, count, &p);
+		if (fd < 0) {
+			LOGD("io_uring_setup : %s, use the blocking I/O\n", strerror(errno));
+			fd = -1;
+			return false;
+		}
+		if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+			LOGD("io_uring too old, use the blocking I/O\n");
+			Exit();
+			return false;
+		}
+		sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+			LOGE("io_uring mmap : %s\n", strerror(errno));
+			Exit();
+			return false;
+		}
+		sqHead = (unsigned*)((char*)sqRing + p.sq_off.head);
+		sqTail = (unsigned*)((char*)sqRing + p.sq_off.tail);
+		sqMask = (unsigned*)((char*)sqRing + p.sq_off.ring_mask);
+		sqArray = (unsigned*)((char*)sqRing + p.sq_off.array);
+		cqHead = (unsigned*)((char*)cqRing + p.cq_off.head);
+		cqTail = (unsigned*)((char*)cqRing + p.cq_off.tail);
+		cqMask = (unsigned*)((char*)cqRing + p.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe*)((char*)cqRing + p.cq_off.cqes);
+		entries = p.sq_entries;
+		sqeTail = submitted = *sqTail;
+		return true;
+	}
+	//Next free submission entry, cleared. NULL if the queue is full.
+	struct io_uring_sqe* GetSqe()
+	{
+		if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= entries) {
+			return NULL;
+		}
+		unsigned index = sqeTail & *sqMask;
+		sqArray[index] = index;
+		memset(&sqes[index], 0, sizeof(sqes[index]));
+		sqeTail++;
+		return &sqes[index];
+	}
+	//Submits the prepared entries, and waits for the next completion.
+	bool Next(struct io_uring_cqe& cqe)
+	{
+		for (;;) {
+			unsigned head = *cqHead;
+			if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				cqe = cqes[head & *cqMask];
+				__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			__atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+			int r = (int)syscall(__NR_io_uring_enter, fd, sqeTail - submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (r < 0) {
+				if (errno == EINTR) {
+					continue;
 				}
-				continue;
+				LOGE("io_uring_enter : %s\n", strerror(errno));
+				return false;
 			}
-			//get key
-			const char *sok = p; //start of key - 160606
-			const char *eok = NULL; //end of key - 160606
-			//remove && *p!='[' condition to allow key like 'key[0]' - 160606
-			while(p<e && *p!='=' && *p!='\r' && *p!='\n') {
-				p++;
+			submitted += r;
+		}
+	}
+	//Waits for the count entries still in flight, so the kernel no longer uses their buffers after the return.
+	//A ring failing for good is torn down, its entries are cancelled by the close.
+	void Drain(int count)
+	{
+		struct io_uring_cqe cqe;
+		while (count > 0) {
+			if (Next(cqe)) {
+				count--;
+			} else if (errno != EAGAIN && errno != EBUSY) {
+				LOGE("io_uring is torn down, %d entries in flight\n", count);
+				Exit();
+				return;
 			}
-			if (*p != '=' || p == sok) {
-				LOGE("No key!\n");
-				p++;
-				continue;
+		}
+	}
+	bool IsReady() const {return fd != -1;}
+};
+
+static IoUring*
+GetThreadRing()
+{
+	static thread_local IoUring ring;
+	static thread_local int state = 0; //0:not tried 1:ready -1:unavailable
+	if (state == 0) {
+		state = ring.Init(ringDepth * 2) ? 1 : -1;
+	}
+	return state == 1 && ring.IsReady() ? &ring : NULL;
+}
+
+static void
+RingPrepRead(IoUring& ring, int fd, char* buf, size_t size, size_t chunk, size_t done)
+{
+	struct io_uring_sqe* sqe = ring.GetSqe();
+	size_t offset = chunk * ringChunk + done;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)(buf + offset);
+	sqe->len = (unsigned)(min(ringChunk * (chunk + 1), size) - offset);
+	sqe->off = offset;
+	sqe->user_data = chunk;
+}
+
+//Reads with ringDepth chunks in flight, and calculates the CRC32 from the crcFrom of the arrived chunks meanwhile.
+static bool
+RingRead(IoUring& ring, int fd, char* buf, size_t size, size_t crcFrom, unsigned int& crc)
+{
+	size_t chunks = (size + ringChunk - 1) / ringChunk;
+	std::vector<size_t> done(chunks, 0);
+	size_t next = 0;
+	size_t crcChunk = 0;
+	int inFlight = 0;
+	int err = 0;
+	crc = 0xFFFFFFFF;
+	while (inFlight || (!err && crcChunk < chunks)) {
+		while (!err && next < chunks && inFlight < ringDepth) {
+			RingPrepRead(ring, fd, buf, size, next++, 0);
+			inFlight++;
+		}
+		struct io_uring_cqe cqe;
+		if (!ring.Next(cqe)) {
+			ring.Drain(inFlight);
+			return false;
+		}
+		inFlight--;
+		size_t chunk = (size_t)cqe.user_data;
+		if (cqe.res <= 0) {
+			err = cqe.res ? -cqe.res : EIO;//0 : the file got shorter
+			continue;
+		}
+		done[chunk] += cqe.res;
+		size_t chunkLen = min(ringChunk, size - chunk * ringChunk);
+		if (done[chunk] < chunkLen && !err) {
+			RingPrepRead(ring, fd, buf, size, chunk, done[chunk]);
+			inFlight++;
+		}
+		for (; crcChunk < chunks && done[crcChunk] == min(ringChunk, size - crcChunk * ringChunk); crcChunk++) {
+			size_t from = max(crcChunk * ringChunk, crcFrom);
+			size_t to = min(ringChunk * (crcChunk + 1), size);
+			if (from < to) {
+				crc = UpdateCRC32(crc, buf + from, to - from);
 			}
-			eok = p; //end of key - 160606
-			while (*(eok - 1) == ' ') {
-				eok--;//remove trail blank
+		}
+	}
+	if (err) {
+		LOGE("io_uring read : %s\n", strerror(err));
+		return false;
+	}
+	return true;
+}
+
+struct RingSlot {
+	std::string str;
+	size_t offset;
+	size_t done;
+	bool busy;
+};
+
+static void
+RingPrepWrite(IoUring& ring, int fd, RingSlot* slots, int slot)
+{
+	struct io_uring_sqe* sqe = ring.GetSqe();
+	RingSlot& s = slots[slot];
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)(s.str.data() + s.done);
+	sqe->len = (unsigned)(s.str.size() - s.done);
+	sqe->off = s.offset + s.done;
+	sqe->user_data = slot;
+}
+
+//Writes the pieces made by the next while the previous pieces are in flight.
+//Then the CRC is written linked with the fsync, crc32str gets the CRC if writeCRC.
+static bool
+RingWrite(IoUring& ring, int fd, bool writeCRC, const std::function<bool(std::string&)>& next, char* crc32str)
+{
+	RingSlot slots[ringDepth];
+	for (int i = 0; i < ringDepth; i++) {
+		slots[i].busy = false;
+	}
+	unsigned int crc = 0xFFFFFFFF;
+	size_t offset = 0;
+	bool finished = false;
+	int inFlight = 0;
+	int err = 0;
+	while (inFlight || (!err && !finished)) {
+		int slot = 0;
+		while (slot < ringDepth && slots[slot].busy) {
+			slot++;
+		}
+		if (!err && !finished && slot < ringDepth) {
+			RingSlot& s = slots[slot];
+			s.str.clear();
+			size_t bodyFrom = 0;
+			if (offset == 0 && writeCRC) {
+				s.str.append((const char*)crcHeaderSig, sizeof(crcHeaderSig));
+				s.str.append(crc32StrSize, '0');
+				s.str.append(EOL, EOL_LEN);
+				bodyFrom = crcHeaderSize;
 			}
-			*(char*)eok = 0;
-			LOGD("key(%d)='%s'\n", eok - sok, sok);
-			if (p<e) {
-				p++;
+			finished = next(s.str);
+			crc = UpdateCRC32(crc, s.str.data() + bodyFrom, s.str.size() - bodyFrom);
+			if (!s.str.empty()) {
+				s.offset = offset;
+				s.done = 0;
+				s.busy = true;
+				offset += s.str.size();
+				RingPrepWrite(ring, fd, slots, slot);
+				inFlight++;
 			}
-			while (p<e && *p == ' ') {
-				p++;//remove precede blank
+			continue;
+		}
+		struct io_uring_cqe cqe;
+		if (!ring.Next(cqe)) {
+			//The slots on the stack are written from until all are completed.
+			ring.Drain(inFlight);
+			return false;
+		}
+		inFlight--;
+		RingSlot& s = slots[cqe.user_data];
+		if (cqe.res <= 0) {
+			err = cqe.res ? -cqe.res : EIO;//0 : nothing written, retrying would loop forever
+			s.busy = false;
+			continue;
+		}
+		s.done += cqe.res;
+		if (s.done < s.str.size() && !err) {
+			RingPrepWrite(ring, fd, slots, (int)cqe.user_data);
+			inFlight++;
+		} else {
+			s.busy = false;
+		}
+	}
+	if (err) {
+		LOGE("io_uring write : %s\n", strerror(err));
+		return false;
+	}
+	StatAdd(Ini::StatBytesWritten, offset);
+
+	//All written, so the fsync covers them.
+	int ops = 1;
+	if (writeCRC) {
+		snprintf(crc32str, crc32StrSize + 1, "%08X", crc ^ 0xFFFFFFFF);
+		struct io_uring_sqe* sqe = ring.GetSqe();
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = (unsigned long)crc32str;
+		sqe->len = crc32StrSize;
+		sqe->off = sizeof(crcHeaderSig);
+		sqe->flags = IOSQE_IO_LINK;
+		ops++;
+	}
+	struct io_uring_sqe* sqe = ring.GetSqe();
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = fd;
+	StatAdd(Ini::StatFileSync);
+	for (; ops; ops--) {
+		struct io_uring_cqe cqe;
+		if (!ring.Next(cqe)) {
+			//The crc32str is written from until the linked entries are completed.
+			ring.Drain(ops);
+			return false;
+		}
+		if (cqe.res < 0 && !err) {
+			err = -cqe.res;
+		}
+	}
+	if (err) {
+		LOGE("io_uring crc write, fsync : %s\n", strerror(err));
+		return false;
+	}
+	return true;
+}
+#endif //INI_IO_URING
+
+bool
+Ini::LoadFileQueued(const char* theFileName, bool checkCRC)
+{
+#ifdef INI_IO_URING
+	IoUring* ring = GetThreadRing();
+	if (ring) {
+		unsigned long long statStart = StatStart();
+		int fd = open(theFileName, O_RDONLY);
+		if (fd == -1) {
+			LOGE("open : %s (%s)\n", theFileName, strerror(errno));
+			return false;
+		}
+		struct stat fileStat;
+		if (fstat(fd, &fileStat)) {
+			LOGE("fstat : %s (%s)\n", theFileName, strerror(errno));
+			close(fd);
+			return false;
+		}
+		size_t size = fileStat.st_size;
+		char* buf = (char*)IniAlloc(size + 1);
+		if (buf == NULL) {
+			LOGE("alloc(%d) : %s\n", size, theFileName);
+			close(fd);
+			return false;
+		}
+		unsigned int crc;
+		bool result = RingRead(*ring, fd, buf, size, crcHeaderSize, crc);
+		close(fd);
+		if (result) {
+			buf[size] = 0;
+			crc ^= 0xFFFFFFFF;
+			StatAdd(StatBytesRead, size);
+			StatTime(StatLoadReadTime, statStart);
+			return LoadBuffer(theFileName, buf, size, checkCRC, &crc, NULL, true);
+		}
+		IniFree(buf);
+		return result;
+	}
+#endif
+	return LoadFile(theFileName, checkCRC);
+}
+
+bool
+Ini::SaveFileQueued(const char* theFileName, bool writeCRC)
+{
+#ifdef INI_IO_URING
+	IoUring* ring = GetThreadRing();
+	if (ring) {
+		if (IsUnchangedSave(theFileName)) {
+			LOGN("Contents not changed : %s\n", theFileName);
+			return true;
+		}
+		unsigned long long statStart = StatStart();
+		int fd = open(theFileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1) {
+			LOGE("open for write : %s (%s)\n", theFileName, strerror(errno));
+			return false;
+		}
+		char crc32str[crc32StrSize + 1] = { 0 };
+		size_t sect = 0;
+		size_t item = 0;
+		bool result = RingWrite(*ring, fd, writeCRC, [&](std::string& str) { return Serialize(sect, item, str, ringChunk); }, crc32str);
+		close(fd);
+		StatTime(StatSaveTime, statStart);
+		if (result) {
+			contentsChanged = false;
+			if (0 == strcmp(theFileName, iniFileName)) {
+				UpdateFileStamp(crc32str);
 			}
-			//get value
-			const char *sov = p; //start of value - 160606
-			while (p<e && *p != '\r' && *p != '\n') {
-				p++;
+		}
+		return result;
+	}
+#endif
+	return SaveFile(theFileName, writeCRC);
+}
+
+bool
+Ini::LoadFileAsync(const char* theFileName, CompletionFunc done, void* context, bool checkCRC)
+{
+	std::string fileName(theFileName);
+	ioWorkers.Queue([this, fileName, checkCRC, done, context]() {
+		bool result = LoadFileQueued(fileName.c_str(), checkCRC);
+		if (done) {
+			done(this, result, context);
+		}
+	});
+	return true;
+}
+
+bool
+Ini::SaveFileAsync(const char* theFileName, CompletionFunc done, void* context, bool writeCRC)
+{
+	std::string fileName(theFileName ? theFileName : iniFileName);
+	ioWorkers.Queue([this, fileName, writeCRC, done, context]() {
+		bool result = SaveFileQueued(fileName.c_str(), writeCRC);
+		if (done) {
+			done(this, result, context);
+		}
+	});
+	return true;
+}
+
+//Remember the size, mtime and CRC of the file behind the iniFileName for the ReloadFile.
+void
+Ini::UpdateFileStamp(const char* crc32str)
+{
+	struct stat fileStat;
+	if (*iniFileName == 0 || stat(iniFileName, &fileStat)) {
+		fileSize = -1;
+		return;
+	}
+	fileSize = fileStat.st_size;
+	fileMTime = fileStat.st_mtime;
+#if defined(__linux__)
+	fileMTimeNsec = fileStat.st_mtim.tv_nsec;
+#else
+	fileMTimeNsec = 0;
+#endif
+	snprintf(fileCRC, sizeof(fileCRC), "%s", crc32str ? crc32str : "");
+}
+
+//Forget the file, the contents no longer come from it.
+void
+Ini::ClearFileStamp()
+{
+	memset(iniFileName,0,sizeof(iniFileName));
+	fileSize = -1;
+	fileCRC[0] = 0;
+}
+
+//Reload the file behind the GetFileName if it is changed, and apply the differences only.
+//Unchanged items keep their storage, and the pool is not moved during the reload.
+//Returns the number of changed items, or -1 on error.
+int
+Ini::ReloadFile(bool checkCRC)
+{
+	if (*iniFileName == 0) {
+		LOGE("%s : no file name\n", __FUNCTION__);
+		return -1;
+	}
+	struct stat fileStat;
+	if (stat(iniFileName, &fileStat)) {
+		LOGE("stat : %s (%s)\n", iniFileName, strerror(errno));
+		return -1;
+	}
+#if defined(__linux__)
+	long mtimeNsec = fileStat.st_mtim.tv_nsec;
+#else
+	long mtimeNsec = 0;
+#endif
+	if (fileSize == (long)fileStat.st_size && fileMTime == fileStat.st_mtime && fileMTimeNsec == mtimeNsec) {
+		LOGD("%s : unchanged stat : %s\n", __FUNCTION__, iniFileName);
+		return 0;
+	}
+	if (*fileCRC) {
+		char header[crcHeaderSize];
+		FILE* file = fopen(iniFileName, "rb");
+		if (file == NULL) {
+			LOGE("fopen : %s (%s)\n", iniFileName, strerror(errno));
+			return -1;
+		}
+		size_t headerLen = fread(header, 1, sizeof(header), file);
+		fclose(file);
+		if (headerLen == sizeof(header) && memcmp(header, crcHeaderSig, sizeof(crcHeaderSig)) == 0
+			&& memcmp(header + sizeof(crcHeaderSig), fileCRC, crc32StrSize) == 0) {
+			LOGD("%s : unchanged CRC : %s\n", __FUNCTION__, iniFileName);
+			UpdateFileStamp(fileCRC);
+			return 0;
+		}
+	}
+
+	//The tokens stay in the adopted load buffer.
+	Ini next(1024);
+	next.SetMultiValueKeys(multiValueKeys, multiValueDelim);
+	if (!next.LoadFile(iniFileName, checkCRC)) {
+		return -1;
+	}
+	bool pinned = pinPool;
+	pinPool = true;
+	int changes = ApplyFrom(next); //dispatches the changes once
+	pinPool = pinned;
+	if (changes < 0) {
+		return -1;
+	}
+	fileSize = next.fileSize;
+	fileMTime = next.fileMTime;
+	fileMTimeNsec = next.fileMTimeNsec;
+	memcpy(fileCRC, next.fileCRC, sizeof(fileCRC));
+	LOGD("%s : %d items changed : %s\n", __FUNCTION__, changes, iniFileName);
+	return changes;
+}
+
+//Merge walk of the sorted items. Returns the number of changed items, or -1 on error.
+int
+Ini::ApplyItems(Section& dst, const Section& src)
+{
+	int changes = 0;
+	ItemList::iterator d = dst.items.begin();
+	for (ItemList::const_iterator s = src.items.begin(); s != src.items.end(); s++) {
+		while (d != dst.items.end() && StringNoCaseCompare(d->key, s->key, maxSectKeyLen) < 0) {
+			Changed(dst.key, d->key, 0);
+			d = dst.items.erase(d);
+			changes++;
+		}
+		if (d == dst.items.end() || StringNoCaseCompare(d->key, s->key, maxSectKeyLen)) {
+			try {
+				d = dst.items.insert(d, Item());
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, dst.key, s->key);
+				return -1;
 			}
-			const char *eov = p; //end of value - 160606
-			while (*(eov - 1) == ' ') {
-				eov--;//remove trail blank
+			if (CreateItem(*d, s->key, s->val)) {
+				dst.items.erase(d);
+				return -1;
 			}
-			*(char*)eov = 0;
-			LOGD("val(%d)='%s'\n", eov - sov, sov);
-			if (sok && *sok) { //*Allow empty section - 160530
-				if (SetValueStr(sos, sok, sov, sorted ? true : false)) { //allow empty value
-					break;
+			Changed(dst.key, d->key, 0);
+			d++;
+			changes++;
+			continue;
+		}
+		if (d->valLen != s->valLen || memcmp(d->val, s->val, s->valLen)) {
+			if (s->valLen + 1 <= d->valRoom) {
+				memcpy((void*)d->val, s->val, s->valLen + 1);
+			} else {
+				const char* val = PushString(s->val);
+				if (val == NULL) {
+					return -1;
+				}
+				d->val = val;
+				d->valRoom = s->valLen + 1;
+			}
+			d->valLen = s->valLen;
+			Changed(dst.key, d->key, 0);
+			changes++;
+		}
+		d++;
+	}
+	while (d != dst.items.end()) {
+		Changed(dst.key, d->key, 0);
+		d = dst.items.erase(d);
+		changes++;
+	}
+	if (changes) {
+		dst.dirty = true;
+		contentsChanged = true;
+	}
+	return changes;
+}
+
+//Make the contents same as the src, touching the differences only.
+//Returns the number of changed items, or -1 on error.
+int
+Ini::ApplyFrom(const Ini& src)
+{
+	BatchGuard batch(*this);
+	int changes = 0;
+	SectionList::iterator d = sects.begin();
+	for (SectionList::const_iterator s = src.sects.begin(); s != src.sects.end(); s++) {
+		while (d != sects.end() && StringNoCaseCompare(d->key, s->key, maxSectKeyLen) < 0) {
+			changes += d->items.size();
+			Changed(d->key, NULL, 0);
+			d = sects.erase(d);
+		}
+		if (d == sects.end() || StringNoCaseCompare(d->key, s->key, maxSectKeyLen)) {
+			try {
+				d = sects.insert(d, Section());
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory : [%s]\n", __FUNCTION__, s->key);
+				changes = -1;
+				break;
+			}
+			d->key = PushString(s->key);
+			d->keyLen = s->keyLen;
+			if (d->key == NULL) {
+				sects.erase(d);
+				changes = -1;
+				break;
+			}
+		}
+		int itemChanges = ApplyItems(*d, *s);
+		if (itemChanges < 0) {
+			changes = -1;
+			break;
+		}
+		changes += itemChanges;
+		d++;
+	}
+	while (changes >= 0 && d != sects.end()) {
+		changes += d->items.size();
+		Changed(d->key, NULL, 0);
+		d = sects.erase(d);
+	}
+	if (changes) {
+		contentsChanged = true;
+	}
+	lastParsedSection = sects.end();
+	lastFoundSectionFFS = sects.end();
+	lastFoundSectionFFK = sects.end();
+	return changes;
+}
+
+void
+Ini::SetFileName(const char* theFileName)
+{
+	snprintf(iniFileName, sizeof(iniFileName), "%s", theFileName);
+}
+
+const char*
+Ini::GetFileName()
+{
+	return iniFileName;
+}
+
+//buf shall be terminated with null character
+bool
+Ini::FromString(const char* buf, size_t buflen, bool sorted)
+{
+	return FromBuffer(buf, buflen, sorted, NULL);
+}
+
+//FromString taking the own like the Parse.
+bool
+Ini::FromBuffer(const char* buf, size_t buflen, bool sorted, char* own)
+{
+	if (!subscriptions.empty()) {
+		//Parse aside and apply the differences, so the subscribers hear about the actual changes only.
+		Ini parsed(own ? 1024 : max(buflen * 2, (size_t)1024));
+		parsed.SetMultiValueKeys(multiValueKeys, multiValueDelim);
+		if (!parsed.FromBuffer(buf, buflen, sorted, own)) {
+			return false;
+		}
+		if (ApplyFrom(parsed) < 0) {
+			return false;
+		}
+		//Not the file any more, like the Reset of the Parse.
+		ClearFileStamp();
+		return true;
+	}
+	return Parse(buf, buflen, sorted, NULL, own);
+}
+
+//An item found by the parser, gathered to go into the sections at once.
+struct ParsedItem {
+	unsigned long long sectHead; //first 8 bytes folded to lower case, compared before the strings
+	unsigned long long keyHead;
+	const char* sect;
+	const char* key;
+	const char* val;
+};
+typedef std::vector<ParsedItem, IniStlAllocator<ParsedItem>> ParsedItemList;
+
+//Orders like the StringNoCaseCompare, as the strings end with 0 and the folded bytes are unsigned.
+static inline unsigned long long
+FoldHead(const char* s)
+{
+	unsigned long long head = 0;
+	for (int i = 0; i < 8; i++) {
+		head <<= 8;
+		if (*s) {
+			head |= (unsigned char)tolower((unsigned char)*s++);
+		}
+	}
+	return head;
+}
+
+//The equal heads ending with 0 hold the whole strings, so the strings are equal too.
+static inline int
+CompareParsedItem(const ParsedItem& a, const ParsedItem& b)
+{
+	//The items of a section block share the sect token.
+	if (a.sect != b.sect) {
+		if (a.sectHead != b.sectHead) {
+			return a.sectHead < b.sectHead ? -1 : 1;
+		}
+		if (a.sectHead & 0xFF) {
+			int result = StringNoCaseCompare(a.sect, b.sect, Ini::maxSectKeyLen);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	if (a.keyHead != b.keyHead) {
+		return a.keyHead < b.keyHead ? -1 : 1;
+	}
+	return (a.keyHead & 0xFF) ? StringNoCaseCompare(a.key, b.key, Ini::maxSectKeyLen) : 0;
+}
+
+//Sort the items once by the section and the key, keeping the file order of the duplicates.
+static void
+SortParsedItems(ParsedItemList& items)
+{
+	std::stable_sort(items.begin(), items.end(), [](const ParsedItem& a, const ParsedItem& b) {
+		return CompareParsedItem(a, b) < 0;
+	});
+}
+
+//Tokenize the buf in place into the empty Ini.
+//If crc is not NULL, it gets the CRC32 of the buf, taken a block ahead of the tokenizer before any byte is touched,
+//so the block is still in the cache when the tokenizer walks it.
+//own is the allocation by the IniAlloc holding the buf, or NULL. It is taken, parsed or not, and kept as a pool chunk
+//so the items point at the tokens in place instead of copying them into the pool.
+bool
+Ini::Parse(const char* buf, size_t buflen, bool sorted, unsigned int* crc, char* own)
+{
+	bool result = false;
+
+	Reset();
+	if (own) {
+		try {
+			poolChunks.push_back(own);
+			adoptFrom = buf;
+			adoptTo = buf + buflen + 1; //an empty value at the end points at the terminator
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : can't adopt the buffer, the tokens are copied\n", __FUNCTION__);
+			IniFree(own);
+			own = NULL;
+		}
+	}
+
+	do {
+		const char *p = buf;
+		const char *e = buf + buflen;
+		const char *sos = NULL; //start of section
+		const char *crcEnd = crc ? buf : e;
+		if (crc) {
+			*crc = 0xFFFFFFFF;
+		}
+		//Called before the byte at x is touched.
+		auto crcAhead = [&](const char* x) {
+			if (crcEnd <= x && crcEnd < e) {
+				const char* to = min(e, max(x + 1, crcEnd + crcBlockSize));
+				*crc = UpdateCRC32(*crc, crcEnd, to - crcEnd);
+				crcEnd = to;
+			}
+		};
+
+		if (!ValidateFormat(buf, buflen)) {
+			break;
+		}
+
+		//A sorted file is appended as it goes, checking the order of each item against the previous one.
+		//The items of an unsorted file, or the rest of a sorted file found out of order, are gathered
+		//and sorted once instead of inserting each into the sorted lists.
+		ParsedItemList parsed;
+		bool gather = false;
+		bool failed = false;
+		const char* sect = "";
+		unsigned long long sectHead = 0;
+		const char* prevSect = NULL;
+		const char* prevKey = NULL;
+		auto startGather = [&]() {
+			gather = true;
+			if (sorted) {
+				//Tokenized by the '=', the count is an upper bound.
+				size_t count = 0;
+				for (const char* eq = buf; (eq = (const char*)memchr(eq, '=', e - eq)) != NULL; eq++) {
+					count++;
+				}
+				parsed.reserve(count);
+			}
+			//Take back what is appended so far, the strings stay where they are.
+			for (SectionList::iterator it = sects.begin(); it != sects.end(); it++) {
+				unsigned long long head = FoldHead(it->key);
+				for (ItemList::iterator item = it->items.begin(); item != it->items.end(); item++) {
+					ParsedItem gathered = { head, FoldHead(item->key), it->key, item->key, item->val };
+					parsed.push_back(gathered);
+				}
+			}
+			sects.clear();
+			lastParsedSection = sects.end();
+		};
+		try {
+			if (!sorted) {
+				startGather();
+			}
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : out of memory\n", __FUNCTION__);
+			break;
+		}
+		while(p<e) {
+			while(p<e && (!*p || *p==' ' || *p=='\r' || *p=='\n' || *p=='\t')) {
+				p++;
+			}
+			if (e <= p) {
+				break;
+			}
+			if (*p=='[') {
+				p++;
+				//get sect
+				while(p<e && *p==' ') {
+					p++;
+				}
+				sos = p; //start of section
+				const char *eos = NULL; //end of section
+				while(p<e && *p!='\r' && *p!='\n') {
+					if (*p == ']') {
+						eos = p;
+					}
+					p++;
+				}
+				if (eos) {					
+					while (*(eos-1) == ' ') {
+						eos--;//remove trail blank
+					}
+					crcAhead(eos);
+					*(char*)eos = 0;
+					LOGD("sect(%d)='%s'\n", eos - sos, sos);
+				}
+				continue;
+			} else if (*p==';' || *p=='#') { //Add '#' for the remarks - 160530
+				//remarks
+				while(p<e && *p!='\r' && *p!='\n') {
+					p++;
+				}
+				continue;
+			}
+			//get key
+			const char *sok = p; //start of key - 160606
+			const char *eok = NULL; //end of key - 160606
+			//remove && *p!='[' condition to allow key like 'key[0]' - 160606
+			while(p<e && *p!='=' && *p!='\r' && *p!='\n') {
+				p++;
+			}
+			if (*p != '=' || p == sok) {
+				LOGE("No key!\n");
+				p++;
+				continue;
+			}
+			eok = p; //end of key - 160606
+			while (*(eok - 1) == ' ') {
+				eok--;//remove trail blank
+			}
+			crcAhead(eok);
+			*(char*)eok = 0;
+			LOGD("key(%d)='%s'\n", eok - sok, sok);
+			if (p<e) {
+				p++;
+			}
+			while (p<e && *p == ' ') {
+				p++;//remove precede blank
+			}
+			//get value
+			const char *sov = p; //start of value - 160606
+			while (p<e && *p != '\r' && *p != '\n') {
+				p++;
+			}
+			const char *eov = p; //end of value - 160606
+			while (*(eov - 1) == ' ') {
+				eov--;//remove trail blank
+			}
+			crcAhead(eov);
+			*(char*)eov = 0;
+			LOGD("val(%d)='%s'\n", eov - sov, sov);
+			if (sok && *sok) { //*Allow empty section - 160530
+				if (sos && sect != sos) {
+					sect = sos;
+					if (gather) {
+						//Folded after the key is terminated, which ends a section without ']'.
+						sectHead = FoldHead(sect);
+					}
+				}
+				if (!gather) {
+					int order = prevKey == NULL ? -1 : prevSect == sect ? 0 : StringNoCaseCompare(prevSect, sect, maxSectKeyLen);
+					if (order < 0 || (order == 0 && StringNoCaseCompare(prevKey, sok, maxSectKeyLen) < 0)) {
+						prevSect = sect;
+						prevKey = sok;
+						if (SetValueStr(sect, sok, sov, true)) { //allow empty value
+							failed = true;
+							break;
+						}
+						continue;
+					}
+					LOGN("%s : the sorted file is out of order at [%s] %s, sort it\n", __FUNCTION__, sect, sok);
+					StatAdd(StatParseSort);
+					sectHead = FoldHead(sect);
+					try {
+						startGather();
+					} catch (const std::bad_alloc&) {
+						LOGE("%s : out of memory\n", __FUNCTION__);
+						failed = true;
+						break;
+					}
+				}
+				ParsedItem item = { sectHead, FoldHead(sok), sect, sok, sov };
+				try {
+					parsed.push_back(item);
+				} catch (const std::bad_alloc&) {
+					LOGE("%s : out of memory\n", __FUNCTION__);
+					failed = true;
+					break;
+				}
+			}
+			sok = NULL;
+			sov = NULL;
+		}
+		if (failed) {
+			break;
+		}
+		if (crc) {
+			crcAhead(e - 1);
+			*crc ^= 0xFFFFFFFF;
+		}
+
+		if (gather) {
+			try {
+				SortParsedItems(parsed);
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory\n", __FUNCTION__);
+				break;
+			}
+			//Append in order, the first spelling of the key gets the last value like setting each line,
+			//or all the values joined for the multi-value keys.
+			//The gathered strings in the pool must not move until all are appended.
+			bool pinned = pinPool;
+			pinPool = true;
+			IniString joined;
+			size_t i = 0;
+			while (i < parsed.size()) {
+				size_t last = i;
+				while (last + 1 < parsed.size() && CompareParsedItem(parsed[i], parsed[last + 1]) == 0) {
+					last++;
+				}
+				const char* val = parsed[last].val;
+				if (multiValueKeys && i < last) {
+					try {
+						joined = parsed[i].val;
+						for (size_t dup = i + 1; dup <= last; dup++) {
+							joined += multiValueDelim;
+							joined += parsed[dup].val;
+						}
+					} catch (const std::bad_alloc&) {
+						LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, parsed[i].sect, parsed[i].key);
+						break;
+					}
+					val = joined.c_str();
+				}
+				if (SetValueStr(parsed[i].sect, parsed[i].key, val, true)) {
+					break;
+				}
+				i = last + 1;
+			}
+			pinPool = pinned;
+			if (i < parsed.size()) {
+				break;
+			}
+		}
+		result = true;
+	} while(0);
+	adoptFrom = adoptTo = NULL;
+	return result;
+}
+
+string
+Ini::ToString()
+{
+	string str;
+	size_t sect = 0;
+	size_t item = 0;
+	Serialize(sect, item, str, (size_t)-1);
+	return str;
+}
+
+//Append the contents in the SaveFile format from the sect, item cursor until the str reaches the limit.
+//Start with 0, 0. Returns true at the end.
+template<typename String>
+bool
+Ini::Serialize(size_t& sect, size_t& item, String& str, size_t limit)
+{
+	for (; sect < sects.size(); sect++, item = 0) {
+		const Section& s = sects[sect];
+		bool finalSect = sect + 1 == sects.size();
+		if (item == 0) {
+			if (limit <= str.size()) {
+				return false;
+			}
+			if (*s.key) {
+				str.push_back('[');
+				str.append(s.key,s.keyLen);
+				str.append("]" EOL,1+EOL_LEN);
+			}
+		}
+		while (item < s.items.size()) {
+			const Item& i = s.items[item++];
+			str.append(i.key,i.keyLen);
+			str.push_back('=');
+			str.append(i.val,i.valLen);
+			if (!finalSect || item < s.items.size()) {
+				str.append(EOL,EOL_LEN);
+			}
+			if (limit <= str.size() && item < s.items.size()) {
+				return false;
+			}
+		}
+		if (!finalSect) {
+			str.append(EOL,EOL_LEN);
+		}
+	}
+	return true;
+}
+
+int
+Ini::GetItemCount() 
+{
+	int itemCount=0;	
+	for (SectionList::iterator sect=sects.begin(); sect!=sects.end(); sect++) {
+		itemCount += sect->items.size();
+	}	
+	return itemCount;
+}
+
+int 
+Ini::GetSectItemCount(const char* sect)
+{
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect != sects.end()) {
+		return foundSect->items.size();
+	}
+	return 0;
+}
+
+Ini::SectionList::iterator
+Ini::FindSection(const char* sect)
+{
+	SectionList::iterator foundSect = lower_bound(sects.begin(), sects.end(), sect, Section::Compare);	
+	if (foundSect==sects.end()) {
+		LOGD("Section not found : '%s'\n", sect);
+		return sects.end();
+	} else {
+		if (StringNoCaseCompare(foundSect->key, sect, maxSectKeyLen)) {
+			LOGD("Section not found : '%s'\n", foundSect->key);
+			return sects.end();
+		} else {
+			LOGD("Section exist : '%s'\n", foundSect->key);
+			return foundSect;
+		}
+	}
+}
+
+Ini::ItemList::iterator
+Ini::FindItem(const char* sect, const char*key)
+{
+	unsigned long long statStart = StatStart();
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect==sects.end()) {
+		StatLookup(statStart, false);
+		//return NULL;
+		return emptySection.items.end();//for gpp - 140103
+	}
+	ItemList::iterator foundItem = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
+	if (foundItem==foundSect->items.end()) {
+		LOGD("Item not found : '%s'\n", key);
+		StatLookup(statStart, false);
+		return foundSect->items.end();
+	} else {
+		if (StringNoCaseCompare(foundItem->key, key, maxSectKeyLen)) {
+			LOGD("Item not found : '%s'\n", key);
+			StatLookup(statStart, false);
+			return foundSect->items.end();
+		} else {
+			LOGD("Item exist : '%s'='%s'\n", key, foundItem->val);
+			StatLookup(statStart, true);
+			return foundItem;
+		}
+	}
+}
+
+const char*
+Ini::FindFirstSection()
+{
+	lastFoundSectionFFS = sects.end();
+	if (!sects.empty()) {
+		lastFoundSectionFFS = sects.begin();
+		return lastFoundSectionFFS->key;
+	}
+	return NULL;
+}
+
+const char*
+Ini::FindNextSection()
+{
+	if (lastFoundSectionFFS==sects.end()) {
+		return NULL;
+	}
+	lastFoundSectionFFS++;
+	if (lastFoundSectionFFS==sects.end()) {
+		return NULL;
+	}
+	return lastFoundSectionFFS->key;
+}
+
+Ini::SectionRange
+Ini::Sections() const
+{
+	return SectionRange(sects.begin(), sects.end());
+}
+
+//Empty range if the section is not found.
+Ini::ItemRange
+Ini::Items(const char* sect) const
+{
+	if (!sect) {
+		sect = "";
+	}
+	SectionList::const_iterator foundSect = lower_bound(sects.begin(), sects.end(), sect, Section::Compare);
+	if (foundSect == sects.end() || StringNoCaseCompare(foundSect->key, sect, maxSectKeyLen)) {
+		return ItemRange();
+	}
+	return Items(*foundSect);
+}
+
+template<typename T>
+static Ini::Range<T>
+BoundedRange(const Ini::Range<T>& range, const char* first, const char* last)
+{
+	if (range.empty()) {
+		return range;
+	}
+	typename Ini::Range<T>::const_iterator b = first ? lower_bound(range.begin(), range.end(), first, T::Compare) : range.begin();
+	typename Ini::Range<T>::const_iterator e = last ? lower_bound(b, range.end(), last, T::Compare) : range.end();
+	return Ini::Range<T>(b, max(b, e));
+}
+
+//The keys having the prefix are next to each other in the order, so it is two binary searches.
+template<typename T>
+static Ini::Range<T>
+PrefixRange(const Ini::Range<T>& range, const char* prefix)
+{
+	if (!prefix || !*prefix || range.empty()) {
+		return range;
+	}
+	int len = (int)strlen(prefix);
+	typename Ini::Range<T>::const_iterator b = lower_bound(range.begin(), range.end(), prefix, T::Compare);
+	typename Ini::Range<T>::const_iterator e = upper_bound(b, range.end(), prefix, [len](const char* prefix, const T& t) {
+		return StringNoCaseCompare(prefix, t.key, len) < 0;
+	});
+	return Ini::Range<T>(b, e);
+}
+
+Ini::SectionRange
+Ini::Sections(const char* first, const char* last) const
+{
+	return BoundedRange(Sections(), first, last);
+}
+
+Ini::SectionRange
+Ini::SectionsWithPrefix(const char* prefix) const
+{
+	return PrefixRange(Sections(), prefix);
+}
+
+Ini::ItemRange
+Ini::Items(const char* sect, const char* first, const char* last) const
+{
+	return BoundedRange(Items(sect), first, last);
+}
+
+Ini::ItemRange
+Ini::ItemsWithPrefix(const char* sect, const char* prefix) const
+{
+	return PrefixRange(Items(sect), prefix);
+}
+
+int
+Ini::FindFirstKey(const char* sect, const char** key, const char** val)
+{
+	lastFoundSectionFFK = sects.end();
+	if (!sect) { //+allow empty section - 160531
+		sect = "";
+	}		
+	if (!key || !val) {
+		return 0;
+	}	
+	if (sects.empty()) {
+		return 0;
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect == sects.end()) {
+		return 0;
+	}
+	if (foundSect->items.empty()) {
+		return 0;
+	}
+	lastFoundSectionFFK = foundSect;
+	lastFoundItemFFK = foundSect->items.begin();
+	*key = lastFoundItemFFK->key;
+	*val = lastFoundItemFFK->val;
+	return (int)foundSect->items.size();
+}
+
+int
+Ini::FindNextKey(const char** key, const char** val)
+{
+	if (!key || !val) {
+		return 0;
+	}
+	if (lastFoundSectionFFK == sects.end()) {
+		return 0;
+	}
+	if (lastFoundItemFFK == lastFoundSectionFFK->items.end()) {	
+		LOGD("%s End of item (1)\n", __FUNCTION__);
+		return 0;
+	}
+	if (++lastFoundItemFFK == lastFoundSectionFFK->items.end()) {
+		LOGD("%s End of item (2)\n", __FUNCTION__);
+		return 0;
+	}
+	*key = lastFoundItemFFK->key;
+	*val = lastFoundItemFFK->val;
+	return 1;
+}
+
+bool
+Ini::IsSection(const char* sect)
+{
+//--- allow empty section - 160531
+//	if (!sect) {
+//		return false;
+//	}
+//---
+	return FindSection(sect) != sects.end();
+}
+
+bool
+Ini::IsKey(const char* sect, const char* key)
+{
+	if (!sect) { //+allow empty section - 160531
+		sect = "";
+	}	
+	if (!key) {
+		return false;
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect==sects.end()) {
+		return false;
+	}
+	ItemList::iterator foundItem = FindItem(sect,key);
+	//return foundItem!=foundSect->items.end() && foundItem!=NULL;
+	return foundItem!=emptySection.items.end() && foundItem!=foundSect->items.end();//for gpp - 140103
+}
+
+const char*
+Ini::GetValueStr(const char* sect, const char* key, const char* _default)
+{
+	if (!sect) { //+allow empty section - 160531
+		sect = "";
+	}	
+	if (!key) {
+		return _default;
+	}
+	if (sects.empty()) {
+		return _default;
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect==sects.end()) {
+		StatAdd(StatLookupMiss);
+		return _default;
+	}
+	ItemList::iterator item = FindItem(sect,key);
+	if (item==foundSect->items.end()) {
+		return _default;
+	}
+	return item->val;
+}
+
+void
+Ini::GetValueStrBuf(const char* sect, const char* key, char* strBuf, size_t bufSize, const char* _default)
+{
+	strBuf[0]=0;
+	const char* str=GetValueStr(sect, key);
+	if (str==NULL) {
+		memset(strBuf, 0, bufSize);
+		return;
+	}
+	snprintf(strBuf, bufSize, "%s", str);
+}
+
+int
+Ini::GetValueInt(const char* sect, const char* key, int _default)
+{
+	const char* val = GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return atoi(val);
+}
+
+unsigned int
+Ini::GetValueUInt(const char* sect, const char* key, unsigned int _default)
+{
+	const char* val = GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	char *endptr;
+	return strtoul(val, &endptr, 10);
+}
+
+long
+Ini::GetValueLong(const char* sect, const char* key, long _default/*=0*/)
+{
+	const char* val = GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	char *endptr;
+	return strtol(val, &endptr, 10);
+}
+
+unsigned long
+Ini::GetValueULong(const char* sect, const char* key, unsigned long _default)
+{
+	const char* val = GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	char *endptr;
+	return strtoul(val, &endptr, 10);
+}
+
+float
+Ini::GetValueFloat(const char* sect, const char* key, float _default/*=0.0*/)
+{
+	const char* val=GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	char* endptr;
+	return strtof(val,&endptr);
+}
+
+double
+Ini::GetValueDouble(const char* sect, const char* key, double _default/*=0.0*/)
+{
+	const char* val=GetValueStr(sect,key);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	char* endptr;
+	return strtod(val,&endptr);
+}
+
+//Searches the section once, then merge-joins the sorted keys with the items of the section.
+//When a few keys are asked out of many items, each key is searched from the last match instead.
+int
+Ini::GetSectValues(const char* sect, const char* const* keys, size_t count, ValueSpan* values, bool keysSorted)
+{
+	for (size_t i = 0; i < count; i++) {
+		values[i].val = NULL;
+		values[i].len = 0;
+	}
+	if (!sect) {
+		sect = "";
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect == sects.end()) {
+		StatAdd(StatLookupMiss, count);
+		return 0;
+	}
+	std::vector<size_t, IniStlAllocator<size_t> > order;
+	try {
+		order.resize(count);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory : [%s] %d keys\n", __FUNCTION__, sect, (int)count);
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	if (!keysSorted) {
+		//NULL keys are skipped, they go last.
+		stable_sort(order.begin(), order.end(), [keys](size_t a, size_t b) {
+			if (!keys[a] || !keys[b]) {
+				return keys[a] && !keys[b];
+			}
+			return StringNoCaseCompare(keys[a], keys[b], maxSectKeyLen) < 0;
+		});
+	}
+	const ItemList& items = foundSect->items;
+	bool search = count * 8 < items.size();
+	ItemList::const_iterator item = items.begin();
+	int found = 0;
+	for (size_t i = 0; i < count && item != items.end(); i++) {
+		const char* key = keys[order[i]];
+		if (!key) {
+			continue;
+		}
+		int cmp;
+		if (search) {
+			item = lower_bound(item, items.end(), key, Item::Compare);
+			cmp = item == items.end() ? 1 : StringNoCaseCompare(item->key, key, maxSectKeyLen);
+		} else {
+			while ((cmp = StringNoCaseCompare(item->key, key, maxSectKeyLen)) < 0 && ++item != items.end()) {
+			}
+		}
+		if (item != items.end() && cmp == 0) {
+			values[order[i]].val = item->val;
+			values[order[i]].len = item->valLen;
+			found++;
+		}
+	}
+	StatAdd(StatLookupHit, found);
+	StatAdd(StatLookupMiss, count - found);
+	return found;
+}
+
+//Key of the element index, folded like the StringNoCaseCompare. Without the key, the prefix of the section.
+static void
+ValueIndexName(IniString& name, const char* sect, const char* key)
+{
+	name.clear();
+	for (const char* p = sect; *p; p++) {
+		name += (char)tolower((unsigned char)*p);
+	}
+	name += '\0';
+	for (const char* p = key; p && *p; p++) {
+		name += (char)tolower((unsigned char)*p);
+	}
+}
+
+//Split the val by the delim into the elems, trimming the blanks around each.
+static void
+SplitValue(const char* val, char delim, Ini::ValueList& elems)
+{
+	elems.clear();
+	if (*val == 0) {
+		return;
+	}
+	size_t count = 1;
+	for (const char* p = strchr(val, delim); p && *p; p = strchr(p + 1, delim)) {
+		count++;
+	}
+	elems.reserve(count);
+	const char* p = val;
+	while (true) {
+		const char* end = strchr(p, delim);
+		if (end == NULL) {
+			end = p + strlen(p);
+		}
+		const char* b = p;
+		const char* e = end;
+		while (b < e && (*b == ' ' || *b == '\t')) {
+			b++;
+		}
+		while (b < e && (*(e - 1) == ' ' || *(e - 1) == '\t')) {
+			e--;
+		}
+		Ini::ValueSpan span = { b, (size_t)(e - b) };
+		elems.push_back(span);
+		if (*end == 0) {
+			break;
+		}
+		p = end + 1;
+	}
+}
+
+Ini::ValueRange
+Ini::GetValues(const char* sect, const char* key)
+{
+	if (!sect) {
+		sect = "";
+	}
+	if (!key) {
+		return ValueRange();
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	if (foundSect == sects.end()) {
+		StatAdd(StatLookupMiss);
+		return ValueRange();
+	}
+	ItemList::iterator item = FindItem(sect, key);
+	if (item == foundSect->items.end()) {
+		return ValueRange();
+	}
+	try {
+		IniString name;
+		ValueIndexName(name, sect, key);
+		ValueIndex& index = valueIndexes[name];
+		//The pool may have moved the value since it was indexed.
+		if (index.val != item->val || index.valLen != item->valLen) {
+			index.val = NULL;
+			SplitValue(item->val, multiValueDelim, index.elems);
+			index.val = item->val;
+			index.valLen = item->valLen;
+		}
+		return ValueRange(index.elems.begin(), index.elems.end());
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+		return ValueRange();
+	}
+}
+
+//Drop the element indexes of the changed key, or of the whole section if the key is NULL.
+void
+Ini::DropValueIndexes(const char* sect, const char* key)
+{
+	try {
+		IniString name;
+		ValueIndexName(name, sect ? sect : "", key);
+		if (key) {
+			valueIndexes.erase(name);
+			return;
+		}
+		ValueIndexMap::iterator first = valueIndexes.lower_bound(name);
+		ValueIndexMap::iterator last = first;
+		while (last != valueIndexes.end() && last->first.compare(0, name.size(), name) == 0) {
+			last++;
+		}
+		valueIndexes.erase(first, last);
+	} catch (const std::bad_alloc&) {
+		valueIndexes.clear();
+	}
+}
+
+//Convert the elements with the convert, which parses a number like the strtol.
+template<typename T, typename Convert>
+static size_t
+ConvertValues(Ini::ValueRange elems, T* values, size_t count, Convert convert)
+{
+	size_t converted = 0;
+	for (; converted < count && converted < elems.size(); converted++) {
+		const Ini::ValueSpan& elem = elems[converted];
+		char* end;
+		T value = convert(elem.val, &end);
+		if (end == elem.val || end != elem.val + elem.len) {
+			break;
+		}
+		values[converted] = value;
+	}
+	return converted;
+}
+
+size_t
+Ini::GetValuesInt(const char* sect, const char* key, int* values, size_t count)
+{
+	return ConvertValues(GetValues(sect, key), values, count, [](const char* s, char** end) {
+		return (int)strtol(s, end, 10);
+	});
+}
+
+size_t
+Ini::GetValuesLong(const char* sect, const char* key, long* values, size_t count)
+{
+	return ConvertValues(GetValues(sect, key), values, count, [](const char* s, char** end) {
+		return strtol(s, end, 10);
+	});
+}
+
+size_t
+Ini::GetValuesDouble(const char* sect, const char* key, double* values, size_t count)
+{
+	return ConvertValues(GetValues(sect, key), values, count, [](const char* s, char** end) {
+		return strtod(s, end);
+	});
+}
+
+char*
+Ini::ByteArrayToHexString(const unsigned char* byteArray, size_t sizeByteArray)
+{
+	//00 AB CD ...
+	char* s=(char*)malloc(3*sizeByteArray); //Last blank for the null character.
+	if (s==NULL) {
+		return NULL;
+	}
+	const unsigned char* p=byteArray;
+	char *q=s;
+	//LOGD("ByteArrayToHexString : length=%d, byteArray=", sizeByteArray);
+	for(unsigned int i=0; i<sizeByteArray; i++) {
+		//LOGD("%02X ",(unsigned char)*p);
+		if (*p>=16) *q = *p/16 >= 10 ? ('A' + *p/16 - 10) : '0' + *p/16;
+		else *q='0';
+		q++;
+		if (*p%16) *q = *p%16 >= 10 ? ('A' + *p%16 - 10) : ('0' + *p%16);
+		else *q = '0';
+		q++;
+		if (i+1==sizeByteArray) { 
+			*q=0; 
+			break; 
+		}
+		*q++ = ' ';
+		p++;
+	}
+	//LOGD("\n");
+	return s;
+}
+
+int
+Ini::HexStringToByteArray(const char* hexString, unsigned char* byteArray, size_t sizeByteArray)
+{
+	int hexStrLen = strlen(hexString);
+	const char* p = hexString;
+	const char* e = p + hexStrLen;
+	//LOGD("HexStringToByteArray : strlength=%d, sizeByteArray=%d\n", hexStrLen,sizeByteArray);
+	if (!byteArray) {
+		return 0;
+	}
+	unsigned char* bp=byteArray;
+	while(p<e && (unsigned int)(bp-byteArray) < sizeByteArray) {
+		//LOGD("%02X ",(unsigned char)*p);
+		unsigned char h=0;
+		/***/if ('0'<=*p && *p<='9') h = *p-'0';
+		else if ('A'<=*p && *p<='F') h = *p-'A'+10;
+		else if ('a'<=*p && *p<='f') h = *p-'a'+10;
+		else break;
+		p++;
+		unsigned char l=0;
+		//LOGD("%02X ",(unsigned char)*p);
+		/***/if ('0'<=*p && *p<='9') l = *p-'0';
+		else if ('A'<=*p && *p<='F') l = *p-'A'+10;
+		else if ('a'<=*p && *p<='f') l = *p-'a'+10;
+		else { l=h; h=0; }
+		p++;
+		*bp++ = 16*h + l;
+		while (*p==' ' && p<e) {
+			//LOGD("%02X ",(unsigned char)*p);
+			p++;
+		}
+		if (*p==0) {
+			break;
+		}
+	}
+	return bp-byteArray;
+}
+
+static const char b64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//Lookup tables for the raw value encoding.
+//Encoders emit a whole byte per lookup, decoders map a character straight to its bits.
+//0x80 marks an invalid character, so a block of characters can be validated by OR-ing the lookups.
+struct RawCodecTable
+{
+	char hexPair[256][2];
+	unsigned char hexNibble[256];
+	unsigned char b64Value[256];
+
+	RawCodecTable()
+	{
+		static const char hexDigits[] = "0123456789ABCDEF";
+		memset(hexNibble, 0x80, sizeof(hexNibble));
+		memset(b64Value, 0x80, sizeof(b64Value));
+		for (int i = 0; i < 256; i++) {
+			hexPair[i][0] = hexDigits[i >> 4];
+			hexPair[i][1] = hexDigits[i & 0x0F];
+		}
+		for (int i = 0; i < 16; i++) {
+			hexNibble[(unsigned char)hexDigits[i]] = i;
+			hexNibble[(unsigned char)tolower(hexDigits[i])] = i;
+		}
+		for (int i = 0; i < 64; i++) {
+			b64Value[(unsigned char)b64Digits[i]] = i;
+		}
+	}
+};
+
+static const RawCodecTable&
+GetRawCodecTable()
+{
+	static const RawCodecTable table;
+	return table;
+}
+
+//Encoded length without the null character.
+size_t
+Ini::GetRawEncodedLength(size_t sizeByteArray, RawEncoding encoding)
+{
+	if (sizeByteArray == 0) {
+		return 0;
+	}
+	switch (encoding) {
+	case HexCompact:
+		return 2 * sizeByteArray;
+	case Base64:
+		return (sizeByteArray + 2) / 3 * 4;
+	default:
+		return 3 * sizeByteArray - 1;
+	}
+}
+
+//Writes GetRawEncodedLength(sizeByteArray, encoding) characters and the null character to the s.
+size_t
+Ini::EncodeRaw(const unsigned char* byteArray, size_t sizeByteArray, char* s, RawEncoding encoding)
+{
+	const RawCodecTable& t = GetRawCodecTable();
+	const unsigned char* p = byteArray;
+	const unsigned char* e = byteArray + sizeByteArray;
+	char* q = s;
+
+	if (encoding == HexCompact) {
+		//8 bytes per round, let the compiler keep the table lookups in flight.
+		for (; p + 8 <= e; p += 8, q += 16) {
+			memcpy(q +  0, t.hexPair[p[0]], 2);
+			memcpy(q +  2, t.hexPair[p[1]], 2);
+			memcpy(q +  4, t.hexPair[p[2]], 2);
+			memcpy(q +  6, t.hexPair[p[3]], 2);
+			memcpy(q +  8, t.hexPair[p[4]], 2);
+			memcpy(q + 10, t.hexPair[p[5]], 2);
+			memcpy(q + 12, t.hexPair[p[6]], 2);
+			memcpy(q + 14, t.hexPair[p[7]], 2);
+		}
+		for (; p < e; p++, q += 2) {
+			memcpy(q, t.hexPair[*p], 2);
+		}
+	} else if (encoding == Base64) {
+		for (; p + 3 <= e; p += 3, q += 4) {
+			unsigned int v = (p[0] << 16) | (p[1] << 8) | p[2];
+			q[0] = b64Digits[(v >> 18) & 0x3F];
+			q[1] = b64Digits[(v >> 12) & 0x3F];
+			q[2] = b64Digits[(v >> 6) & 0x3F];
+			q[3] = b64Digits[v & 0x3F];
+		}
+		if (p < e) {
+			unsigned int v = (p[0] << 16) | ((p + 1 < e ? p[1] : 0) << 8);
+			q[0] = b64Digits[(v >> 18) & 0x3F];
+			q[1] = b64Digits[(v >> 12) & 0x3F];
+			q[2] = p + 1 < e ? b64Digits[(v >> 6) & 0x3F] : '=';
+			q[3] = '=';
+			q += 4;
+		}
+	} else {
+		//00 AB CD ...
+		for (; p < e; p++) {
+			memcpy(q, t.hexPair[*p], 2);
+			q += 2;
+			if (p + 1 < e) {
+				*q++ = ' ';
+			}
+		}
+	}
+	*q = 0;
+	return q - s;
+}
+
+//Decodes both of the compact and the blank separated hex strings, and base64 string.
+//Returns the number of bytes written to the byteArray, remaining bytes are untouched.
+size_t
+Ini::DecodeRaw(const char* s, size_t len, unsigned char* byteArray, size_t sizeByteArray, RawEncoding encoding)
+{
+	const RawCodecTable& t = GetRawCodecTable();
+	const unsigned char* p = (const unsigned char*)s;
+	const unsigned char* e = p + len;
+	unsigned char* q = byteArray;
+	unsigned char* qe = byteArray + sizeByteArray;
+
+	if (!byteArray) {
+		return 0;
+	}
+	if (encoding == Base64) {
+		for (; p + 4 <= e && q + 3 <= qe; p += 4, q += 3) {
+			unsigned char v0 = t.b64Value[p[0]], v1 = t.b64Value[p[1]], v2 = t.b64Value[p[2]], v3 = t.b64Value[p[3]];
+			if ((v0 | v1 | v2 | v3) & 0x80) {
+				break;
+			}
+			q[0] = (v0 << 2) | (v1 >> 4);
+			q[1] = (v1 << 4) | (v2 >> 2);
+			q[2] = (v2 << 6) | v3;
+		}
+		//last quantum, padding or the caller's buffer end
+		unsigned int v = 0;
+		int bits = 0;
+		for (; p < e && q < qe; p++) {
+			unsigned char c = t.b64Value[*p];
+			if (c & 0x80) {
+				break;
+			}
+			v = (v << 6) | c;
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				*q++ = (unsigned char)(v >> bits);
+			}
+		}
+		return q - byteArray;
+	}
+
+	while (p < e && q < qe) {
+		//fast path : 8 bytes of the compact hex at once
+		while (p + 16 <= e && q + 8 <= qe) {
+			unsigned char b[8];
+			unsigned char bad = 0;
+			for (int i = 0; i < 8; i++) {
+				unsigned char h = t.hexNibble[p[2 * i]];
+				unsigned char l = t.hexNibble[p[2 * i + 1]];
+				bad |= h | l;
+				b[i] = (unsigned char)((h << 4) | l);
+			}
+			if (bad & 0x80) {
+				break;
+			}
+			memcpy(q, b, 8);
+			p += 16;
+			q += 8;
+		}
+		if (p >= e || q >= qe) {
+			break;
+		}
+		//slow path : blanks, a single nibble and the tail, same as the HexStringToByteArray
+		unsigned char h = t.hexNibble[*p];
+		if (h & 0x80) {
+			break;
+		}
+		p++;
+		unsigned char l = p < e ? t.hexNibble[*p] : 0x80;
+		if (l & 0x80) {
+			l = h;
+			h = 0;
+		}
+		p++;
+		*q++ = (unsigned char)((h << 4) | l);
+		while (p < e && *p == ' ') {
+			p++;
+		}
+	}
+	return q - byteArray;
+}
+
+void
+Ini::GetValueRaw(const char* sect, const char* key, void* byteArray, const size_t sizeByteArray, unsigned char _default/*=0x00*/, RawEncoding encoding/*=HexSpaced*/)
+{
+	if (!sect) {
+		sect = "";
+	}
+	if (key) {
+		SectionList::iterator foundSect = FindSection(sect);
+		if (foundSect != sects.end()) {
+			ItemList::iterator item = FindItem(sect, key);
+			if (item != foundSect->items.end() && item->valLen) {
+				DecodeRaw(item->val, item->valLen, (unsigned char*)byteArray, sizeByteArray, encoding);
+				return;
+			}
+		}
+	}
+	memset(byteArray,_default,sizeByteArray);
+}
+
+//Encodes straight into the free tail of the string pool, no temporary buffer.
+void
+Ini::SetValueRaw(const char* sect, const char* key, const void* byteArray, const size_t sizeByteArray, RawEncoding encoding/*=HexSpaced*/)
+{
+	if (sizeByteArray==0) {
+		SetValueStr(sect, key, "");
+		return;
+	}
+	if (!sect) {
+		sect = "";
+	}
+	if (!key || !byteArray) {
+		return;
+	}
+	BatchGuard batch(*this);
+	if (!IsKey(sect, key) && SetValueStr(sect, key, "")) {
+		return;
+	}
+	size_t encLen = GetRawEncodedLength(sizeByteArray, encoding);
+	char* encoded = ReservePool(encLen + 1);
+	if (encoded == NULL) {
+		return;
+	}
+	EncodeRaw((const unsigned char*)byteArray, sizeByteArray, encoded, encoding);
+
+	//the pool is never reallocated from here, the item stays valid.
+	SectionList::iterator foundSect = FindSection(sect);
+	ItemList::iterator item = FindItem(sect, key);
+	if (item->valLen == encLen && memcmp(item->val, encoded, encLen) == 0) {
+		LOGD("Unchanged item : '%s'\n", key);
+		return;
+	}
+	contentsChanged = true;
+	foundSect->dirty = true;
+	LOGD("Update item : '%s' (%d bytes encoded)\n", key, encLen);
+	if (encLen + 1 <= item->valRoom) {
+		memcpy((void*)item->val, encoded, encLen + 1);
+		item->valLen = encLen;
+	} else {
+		item->val = encoded;
+		item->valLen = encLen;
+		item->valRoom = encLen + 1;
+		posPool += encLen + 1;
+		remPool -= encLen + 1;
+	}
+	Changed(sect, key, 0);
+}
+
+void
+Ini::SetValueStrBuf(const char* sect, const char* key, char* buf, size_t bufSize)
+{
+	char* dupString = (char*)IniAlloc(bufSize);
+	if (!dupString) {
+		return;
+	}
+	snprintf(dupString,bufSize,"%s",buf);
+	SetValueStr(sect,key,dupString);
+	IniFree(dupString);
+	dupString = NULL;
+}
+
+int
+Ini::CreateItem(Item& newItem, const char* key, const char* val) 
+{
+	LOGD("Create item : '%s'='%s'\n", key, val);
+	newItem.key = PushString(key);
+	newItem.keyLen = strlen(key);
+	newItem.val = PushString(val);
+	newItem.valLen = strlen(val);
+	newItem.valRoom = newItem.valLen + 1;
+
+	if (newItem.key != NULL && newItem.val != NULL) {
+		contentsChanged = true;
+		return 0;
+	} else {
+		return 1;
+	}
+}
+
+//The lists out of the allocator throw, which fails the set like the pool out of memory.
+int
+Ini::SetValueStr(const char* sect, const char* key, const char* val, bool sortedFile /*= false*/)
+{
+	try {
+		return InsertValueStr(sect, key, val, sortedFile);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect ? sect : "", key ? key : "");
+		return 1;
+	}
+}
+
+int
+Ini::InsertValueStr(const char* sect, const char* key, const char* val, bool sortedFile)
+{
+	if (!sect) { //+allow empty section - 160531
+		sect = "";
+	}
+	if (!key||!val) {
+		return 1;
+	}
+
+	if (sortedFile) {
+		if (lastParsedSection==sects.end() || StringNoCaseCompare(lastParsedSection->key, sect, maxSectKeyLen)) {
+			LOGD("Create section : '%s'\n", sect);
+
+			Section newSect;
+			Item newItem;
+			newSect.items.push_back(newItem);
+			sects.push_back(newSect);
+
+			sects.back().key = PushString(sect);
+			sects.back().keyLen = strlen(sect);
+			
+			lastParsedSection = --sects.end();			
+
+			return Changed(sect, key, CreateItem(sects.back().items.back(), key, val));
+		} else {
+			Item newItem;
+			lastParsedSection->items.push_back(newItem);
+			lastParsedSection->dirty = true;
+
+			return Changed(sect, key, CreateItem(lastParsedSection->items.back(), key, val));
+		}
+	}
+
+	SectionList::iterator foundSect = lower_bound(sects.begin(), sects.end(), sect, Section::Compare);
+
+	if (foundSect==sects.end()) {
+		LOGD("Create section : '%s'\n", sect);
+
+		Section newSect;
+		Item newItem;
+		newSect.items.push_back(newItem);
+		sects.push_back(newSect);
+
+		sects.back().key = PushString(sect);
+		sects.back().keyLen = strlen(sect);
+		
+		return Changed(sect, key, CreateItem(sects.back().items.back(),key,val));
+	} else {
+		if (StringNoCaseCompare(foundSect->key, sect, maxSectKeyLen)) {
+			LOGD("Insert section : '%s'\n", sect);
+
+			Section newSect;
+			Item newItem;
+			newSect.items.push_back(newItem);
+			SectionList::iterator insSect = sects.insert(foundSect, newSect);
+
+			insSect->key = PushString(sect);
+			insSect->keyLen = strlen(sect);			
+			
+			return Changed(sect, key, CreateItem(insSect->items.back(),key,val));
+		} else {
+			LOGD("Update section : '%s'\n",foundSect->key);
+
+			ItemList::iterator foundItem = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
+
+			if (foundItem==foundSect->items.end()) {
+				Item newItem;
+				foundSect->items.push_back(newItem);
+				foundSect->dirty = true;
+
+				return Changed(sect, key, CreateItem(foundSect->items.back(),key,val));
+			} else {
+				if (StringNoCaseCompare(foundItem->key, key, maxSectKeyLen)) {
+					Item newItem;
+					ItemList::iterator newItemPos = foundSect->items.insert(foundItem, newItem);
+					foundSect->dirty = true;
+
+					return Changed(sect, key, CreateItem(*newItemPos,key,val));
+				} else {
+					size_t valLen = strlen(val);
+					if (strncmp(foundItem->val, val, max(strlen(foundItem->val), valLen))) {
+						contentsChanged = true;
+						foundSect->dirty = true;
+						LOGD("Update item : '%s'='%s'\n", key, val);
+
+						if (valLen + 1 <= foundItem->valRoom) {
+							memcpy((void*)foundItem->val, val, valLen + 1);
+							foundItem->valLen = valLen;
+						} else {
+							foundItem->val = PushString(val);
+							foundItem->valLen = valLen;
+							foundItem->valRoom = valLen + 1;
+						}
+						return Changed(sect, key, 0);
+					} else {
+						LOGD("Unchanged item : '%s'='%s'\n", key, val);
+						return 0;
+					}
+				}
+			}
+		}
+	}
+}
+
+//Grow the value of the item by the element. The room doubles when it moves, so appending N elements
+//copies O(N) bytes. The value at the tail of the pool grows without moving.
+int
+Ini::AppendValue(Item& item, const char* val, size_t valLen)
+{
+	size_t len = item.valLen + (item.valLen ? 1 : 0) + valLen;
+	if (item.valRoom < len + 1) {
+		size_t room = (len + 1) * 2;
+		bool moved = true;
+		if (item.val + item.valRoom == strPool + posPool) {
+			//The ReservePool rebases the item if the pool is reallocated.
+			char* tail = ReservePool(room - item.valRoom);
+			if (tail == NULL) {
+				return 1;
+			}
+			if (tail == item.val + item.valRoom) {
+				posPool += room - item.valRoom;
+				remPool -= room - item.valRoom;
+				item.valRoom = room;
+				moved = false;
+			}
+		}
+		if (moved) {
+			char* dst = ReservePool(room);
+			if (dst == NULL) {
+				return 1;
+			}
+			memcpy(dst, item.val, item.valLen + 1);
+			posPool += room;
+			remPool -= room;
+			item.val = dst;
+			item.valRoom = room;
+		}
+	}
+	char* p = (char*)item.val + item.valLen;
+	if (item.valLen) {
+		*p++ = multiValueDelim;
+	}
+	memcpy(p, val, valLen);
+	p[valLen] = 0;
+	item.valLen = len;
+	return 0;
+}
+
+int
+Ini::SetValueStrMulti(const char* sect, const char* key, const char* val)
+{
+	if (!sect) {
+		sect = "";
+	}
+	if (!key || !val) {
+		return 1;
+	}
+	SectionList::iterator foundSect = FindSection(sect);
+	ItemList::iterator item = foundSect == sects.end() ? emptySection.items.end() : FindItem(sect, key);
+	if (foundSect == sects.end() || item == foundSect->items.end()) {
+		return SetValueStr(sect, key, val);
+	}
+	size_t valLen = strlen(val);
+	int result = 1;
+	if (strPool <= val && val < strPool + sizPool) {
+		//The val in the pool moves with it, so append a copy.
+		char* copy = (char*)IniAlloc(valLen + 1);
+		if (copy) {
+			memcpy(copy, val, valLen + 1);
+			result = AppendValue(*item, copy, valLen);
+			IniFree(copy);
+		}
+	} else {
+		result = AppendValue(*item, val, valLen);
+	}
+	if (result) {
+		LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+		return result;
+	}
+	contentsChanged = true;
+	foundSect->dirty = true;
+	return Changed(sect, key, 0);
+}
+
+void
+Ini::SetValueInt(const char* sect, const char* key, int val)
+{
+	//32bit machine: -2147483648 ~ 2147483647
+	//TBD: fit max int width in the 64bit machine?	
+	char buf[100];
+#if defined (WIN32) && !defined(__CYGWIN__)
+	itoa(val, buf, 10);
+#else
+	snprintf(buf,sizeof(buf),"%d",val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueUInt(const char* sect, const char* key, unsigned int val)
+{
+	//TBD: fit max unsigned int width in the 64bit machine?	
+	char buf[100];
+#ifdef ultoa
+	ultoa(val,buf,10);
+#else	
+	snprintf(buf,sizeof(buf),"%u",val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueLong(const char* sect, const char* key, long val)
+{
+	//long l = -2147483648;//mingw32-gcc: ../ini.cpp:1581:2: error: this decimal constant is unsigned only in ISO C90 [-Werror]	
+	//TBD: fit buffer size to max value width
+	char buf[100];
+#if defined (WIN32)
+	ltoa(val, buf, 10);
+#else
+	snprintf(buf,sizeof(buf),"%ld",val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueULong(const char* sect, const char* key, unsigned long val)
+{
+	//32bit machine: 4,294,967,295
+	char buf[100];
+#ifdef ultoa
+	ultoa(val, buf, 10);
+#else
+	snprintf(buf,sizeof(buf),"%lu",val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueLongLong(const char* sect, const char* key, long long val)
+{
+	//language spec: –9,223,372,036,854,775,808 to 9,223,372,036,854,775,807
+	//but actually...
+	//long long ll = -9223372036854775808; //mingw32-gcc: ../ini.cpp:1610:18: error: integer constant is so large that it is unsigned [-Werror]
+	//TBD: fit buffer size to max value width
+	char buf[sizeof("-9223372036854775808")];
+#if defined(__MINGW32__)
+	lltoa(val, buf, 10);
+#else
+	snprintf(buf, sizeof(buf), "%lld", val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueULongLong(const char* sect, const char* key, unsigned long long val)
+{
+	//language spec: 0 to 18,446,744,073,709,551,615
+	//but actually it is up to 1844674407370955169
+	//unsigned long long ull = 18446744073709551615;//mingw32-gcc: ../ini.cpp:1617:27: error: integer constant is so large that it is unsigned [-Werror]	
+	//TBD: fit buffer size to max value width
+	char buf[sizeof("18446744073709551615")];
+#if defined(__MINGW32__)
+	ulltoa(val, buf, 10);
+#else
+	snprintf(buf, sizeof(buf), "%llu", val);
+#endif
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueFloat(const char* sect, const char* key, float val)
+{
+	char buf[100];
+	//TBD: input x to 0.xf
+	snprintf(buf,100,"%0.7f",val);
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::SetValueDouble(const char* sect, const char* key, double val)
+{
+	char buf[100];
+	//TBD: input x to 0.xf
+	snprintf(buf,100,"%0.7f",val);
+	SetValueStr(sect,key,buf);
+}
+
+void
+Ini::Dump(void)
+{
+	LOGN("%s:\n", __func__);
+	for (SectionList::iterator sect=sects.begin(); sect!=sects.end(); sect++) {
+		LOGN("[%s]\n",sect->key);
+		for (ItemList::iterator item=sect->items.begin(); item!=sect->items.end(); item++) {
+			LOGN("%s=%s\n",item->key,item->val);
+		}
+	}
+}
+
+//------------->8------------->8------------->8------------->8------------->8------------->8
+
+//Merge join of the sorted sections and items. The patch turns this into the 'to'.
+bool
+Ini::Diff(const Ini& to, IniPatch& patch, bool withRemoved) const
+{
+	patch.Clear();
+	bool added = true;
+	SectionList::const_iterator a = sects.begin();
+	SectionList::const_iterator b = to.sects.begin();
+	while (a != sects.end() || b != to.sects.end()) {
+		int r = a == sects.end() ? 1 : b == to.sects.end() ? -1 : StringNoCaseCompare(a->key, b->key, maxSectKeyLen);
+		if (r < 0) {
+			if (withRemoved) {
+				for (ItemList::const_iterator item = a->items.begin(); item != a->items.end(); item++) {
+					added = added && patch.Add(IniPatch::Removed, a->key, a->keyLen, item->key, item->keyLen, "", 0);
+				}
+			}
+			a++;
+			continue;
+		}
+		if (r > 0) {
+			for (ItemList::const_iterator item = b->items.begin(); item != b->items.end(); item++) {
+				added = added && patch.Add(IniPatch::Added, b->key, b->keyLen, item->key, item->keyLen, item->val, item->valLen);
+			}
+			b++;
+			continue;
+		}
+		ItemList::const_iterator x = a->items.begin();
+		ItemList::const_iterator y = b->items.begin();
+		while (x != a->items.end() || y != b->items.end()) {
+			int c = x == a->items.end() ? 1 : y == b->items.end() ? -1 : StringNoCaseCompare(x->key, y->key, maxSectKeyLen);
+			if (c < 0) {
+				if (withRemoved) {
+					added = added && patch.Add(IniPatch::Removed, a->key, a->keyLen, x->key, x->keyLen, "", 0);
+				}
+				x++;
+			} else if (c > 0) {
+				added = added && patch.Add(IniPatch::Added, b->key, b->keyLen, y->key, y->keyLen, y->val, y->valLen);
+				y++;
+			} else {
+				if (x->valLen != y->valLen || memcmp(x->val, y->val, x->valLen)) {
+					added = added && patch.Add(IniPatch::Modified, b->key, b->keyLen, y->key, y->keyLen, y->val, y->valLen);
+				}
+				x++;
+				y++;
+			}
+		}
+		a++;
+		b++;
+	}
+	if (!added) {
+		LOGE("%s : out of memory\n", __FUNCTION__);
+		patch.Clear();
+	}
+	return added;
+}
+
+//Rebuilds the item list of the section in one merge pass over the items and the entries [first, last).
+int
+Ini::ApplyPatchItems(Section& sect, const IniPatch& patch, size_t first, size_t last)
+{
+	int changes = 0;
+	ItemList merged;
+	merged.reserve(sect.items.size() + (last - first));
+	ItemList::iterator d = sect.items.begin();
+	for (size_t i = first; i < last; i++) {
+		const IniPatch::Entry& e = patch.entries[i];
+		const char* key = patch.strings.c_str() + e.key;
+		const char* val = patch.strings.c_str() + e.val;
+		Item* existing = NULL;
+		if (!merged.empty() && StringNoCaseCompare(merged.back().key, key, maxSectKeyLen) == 0) {
+			existing = &merged.back();
+		} else {
+			while (d != sect.items.end() && StringNoCaseCompare(d->key, key, maxSectKeyLen) < 0) {
+				merged.push_back(*d++);
+			}
+			if (d != sect.items.end() && StringNoCaseCompare(d->key, key, maxSectKeyLen) == 0) {
+				merged.push_back(*d++);
+				existing = &merged.back();
+			}
+		}
+		if (e.op == IniPatch::Removed) {
+			if (existing) {
+				Changed(sect.key, key, 0);
+				merged.pop_back();
+				changes++;
+			}
+		} else if (existing) {
+			if (existing->valLen != e.valLen || memcmp(existing->val, val, e.valLen)) {
+				if (e.valLen + 1 <= existing->valRoom) {
+					memcpy((void*)existing->val, val, e.valLen + 1);
+				} else {
+					const char* pushed = PushString(val);
+					if (pushed == NULL) {
+						return -1;
+					}
+					existing->val = pushed;
+					existing->valRoom = e.valLen + 1;
+				}
+				existing->valLen = e.valLen;
+				Changed(sect.key, key, 0);
+				changes++;
+			}
+		} else {
+			Item newItem;
+			if (CreateItem(newItem, key, val)) {
+				return -1;
+			}
+			merged.push_back(newItem);
+			Changed(sect.key, key, 0);
+			changes++;
+		}
+	}
+	merged.insert(merged.end(), d, sect.items.end());
+	sect.items.swap(merged);
+	if (changes) {
+		sect.dirty = true;
+		contentsChanged = true;
+	}
+	return changes;
+}
+
+//Applies the sorted patch in one pass. Returns the number of changed items, or -1 on error.
+int
+Ini::ApplyPatch(const IniPatch& patch)
+{
+	BatchGuard batch(*this);
+	//Reserve the pool at once, so it is not moved under the items being merged.
+	size_t room = 0;
+	for (IniPatch::EntryList::const_iterator e = patch.entries.begin(); e != patch.entries.end(); e++) {
+		room += e->sectLen + e->keyLen + e->valLen + 3;
+	}
+	if (room && ReservePool(room) == NULL) {
+		return -1;
+	}
+	int changes = 0;
+	SectionList::iterator sect = sects.begin();
+	size_t i = 0;
+	while (i < patch.entries.size()) {
+		const char* sectName = patch.strings.c_str() + patch.entries[i].sect;
+		size_t j = i;
+		bool adding = false;
+		while (j < patch.entries.size() && StringNoCaseCompare(patch.strings.c_str() + patch.entries[j].sect, sectName, maxSectKeyLen) == 0) {
+			adding |= patch.entries[j].op != IniPatch::Removed;
+			j++;
+		}
+		sect = lower_bound(sect, sects.end(), sectName, Section::Compare);
+		if (sect == sects.end() || StringNoCaseCompare(sect->key, sectName, maxSectKeyLen)) {
+			if (!adding) {
+				i = j;
+				continue;
+			}
+			try {
+				sect = sects.insert(sect, Section());
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory : [%s]\n", __FUNCTION__, sectName);
+				changes = -1;
+				break;
+			}
+			sect->key = PushString(sectName);
+			sect->keyLen = patch.entries[i].sectLen;
+			if (sect->key == NULL) {
+				sects.erase(sect);
+				changes = -1;
+				break;
+			}
+		}
+		int itemChanges = -1;
+		try {
+			itemChanges = ApplyPatchItems(*sect, patch, i, j);
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : out of memory : [%s]\n", __FUNCTION__, sectName);
+		}
+		if (itemChanges < 0) {
+			changes = -1;
+			break;
+		}
+		changes += itemChanges;
+		if (sect->items.empty()) {
+			Changed(sect->key, NULL, 0);
+			sect = sects.erase(sect);
+		} else {
+			sect++;
+		}
+		i = j;
+	}
+	lastParsedSection = sects.end();
+	lastFoundSectionFFS = sects.end();
+	lastFoundSectionFFK = sects.end();
+	return changes;
+}
+
+//Adds and updates the keys of the other, keeps the keys only this has.
+int
+Ini::Merge(const Ini& other)
+{
+	IniPatch patch;
+	if (!Diff(other, patch, false)) {
+		return -1;
+	}
+	return ApplyPatch(patch);
+}
+
+//Returns false if out of memory, the patch is kept as it was.
+bool
+IniPatch::Add(char op, const char* sect, size_t sectLen, const char* key, size_t keyLen, const char* val, size_t valLen)
+{
+	size_t size = strings.size();
+	try {
+		Entry e;
+		e.op = op;
+		//consecutive entries of the same section share the name
+		if (!entries.empty() && entries.back().sectLen == sectLen && memcmp(strings.c_str() + entries.back().sect, sect, sectLen) == 0) {
+			e.sect = entries.back().sect;
+		} else {
+			e.sect = strings.size();
+			strings.append(sect, sectLen);
+			strings.push_back(0);
+		}
+		e.sectLen = sectLen;
+		e.key = strings.size();
+		e.keyLen = keyLen;
+		strings.append(key, keyLen);
+		strings.push_back(0);
+		e.val = strings.size();
+		e.valLen = valLen;
+		strings.append(val, valLen);
+		strings.push_back(0);
+		entries.push_back(e);
+	} catch (const std::bad_alloc&) {
+		strings.resize(size);
+		return false;
+	}
+	return true;
+}
+
+int
+IniPatch::GetCount(Op op) const
+{
+	int count = 0;
+	for (EntryList::const_iterator e = entries.begin(); e != entries.end(); e++) {
+		count += e->op == op;
+	}
+	return count;
+}
+
+string
+IniPatch::ToString() const
+{
+	string str;
+	str.reserve(strings.size() + entries.size() * (1 + EOL_LEN));
+	const Entry* last = NULL;
+	for (EntryList::const_iterator e = entries.begin(); e != entries.end(); e++) {
+		if (!last || last->sect != e->sect) {
+			str.push_back('[');
+			str.append(strings.c_str() + e->sect, e->sectLen);
+			str.append("]" EOL, 1 + EOL_LEN);
+		}
+		str.push_back(e->op);
+		str.append(strings.c_str() + e->key, e->keyLen);
+		if (e->op != Removed) {
+			str.push_back('=');
+			str.append(strings.c_str() + e->val, e->valLen);
+		}
+		str.append(EOL, EOL_LEN);
+		last = &*e;
+	}
+	return str;
+}
+
+struct ComparePatchEntry {
+	const IniString& strings;
+	ComparePatchEntry(const IniString& strings) : strings(strings) {}
+	bool operator() (const IniPatch::Entry& a, const IniPatch::Entry& b) const {
+		int r = StringNoCaseCompare(strings.c_str() + a.sect, strings.c_str() + b.sect, Ini::maxSectKeyLen);
+		if (r) {
+			return r < 0;
+		}
+		return StringNoCaseCompare(strings.c_str() + a.key, strings.c_str() + b.key, Ini::maxSectKeyLen) < 0;
+	}
+};
+
+bool
+IniPatch::FromString(const char* buf, size_t buflen)
+{
+	Clear();
+	const char* p = buf;
+	const char* e = buf + buflen;
+	const char* sect = "";
+	size_t sectLen = 0;
+	while (p < e) {
+		const char* eol = p;
+		while (eol < e && *eol != '\r' && *eol != '\n' && *eol) {
+			eol++;
+		}
+		if (eol == p) {
+			p++;
+			continue;
+		}
+		if (*p == '[') {
+			const char* eos = eol;
+			while (p < eos && *(eos - 1) != ']') {
+				eos--;
+			}
+			if (eos == p) {
+				LOGE("%s : broken section at %d\n", __FUNCTION__, p - buf);
+				return false;
+			}
+			sect = p + 1;
+			sectLen = eos - 1 - sect;
+		} else if (*p == Added || *p == Modified || *p == Removed) {
+			const char* key = p + 1;
+			const char* eok = key;
+			while (eok < eol && *eok != '=') {
+				eok++;
+			}
+			if (*p != Removed && eok == eol) {
+				LOGE("%s : no value at %d\n", __FUNCTION__, p - buf);
+				return false;
+			}
+			const char* val = eok < eol ? eok + 1 : eol;
+			if (!Add(*p, sect, sectLen, key, eok - key, val, eol - val)) {
+				LOGE("%s : out of memory at %d\n", __FUNCTION__, p - buf);
+				Clear();
+				return false;
+			}
+		} else {
+			LOGE("%s : unknown operation '%c' at %d\n", __FUNCTION__, *p, p - buf);
+			return false;
+		}
+		p = eol;
+	}
+	//keep the order of the same keys, the last one wins
+	stable_sort(entries.begin(), entries.end(), ComparePatchEntry(strings));
+	return true;
+}
+
+//Subscribe to the changes of a key, or of all keys of the section if the key is NULL.
+//Returns the subscription id for the Unsubscribe.
+int
+Ini::Subscribe(const char* sect, const char* key, ChangeCallback callback, void* context)
+{
+	if (!callback) {
+		return 0;
+	}
+	Subscription sub;
+	sub.id = nextSubscriptionId++;
+	sub.sect = sect ? sect : "";
+	sub.key = key ? key : "";
+	sub.wholeSection = key == NULL;
+	sub.prefix = false;
+	sub.callback = callback;
+	sub.context = context;
+	subscriptions.push_back(sub);
+	return sub.id;
+}
+
+//Subscribe to the changes of the keys starting with the keyPrefix in the sections starting with the sectPrefix.
+int
+Ini::SubscribePrefix(const char* sectPrefix, const char* keyPrefix, ChangeCallback callback, void* context)
+{
+	int id = Subscribe(sectPrefix, keyPrefix, callback, context);
+	if (id) {
+		subscriptions.back().wholeSection = false;
+		subscriptions.back().prefix = true;
+	}
+	return id;
+}
+
+void
+Ini::Unsubscribe(int id)
+{
+	for (std::vector<Subscription>::iterator sub = subscriptions.begin(); sub != subscriptions.end(); sub++) {
+		if (sub->id == id) {
+			subscriptions.erase(sub);
+			return;
+		}
+	}
+}
+
+//Changes are coalesced until the outermost EndBatch, then each subscriber is called once.
+void
+Ini::BeginBatch()
+{
+	batchDepth++;
+}
+
+void
+Ini::EndBatch()
+{
+	if (0 < batchDepth && --batchDepth == 0) {
+		DispatchChanges();
+	}
+}
+
+//Records the change if the result is ok, and passes the result through.
+int
+Ini::Changed(const char* sect, const char* key, int result)
+{
+	if (result == 0 && !valueIndexes.empty()) {
+		DropValueIndexes(sect, key);
+	}
+	if (result || subscriptions.empty()) {
+		return result;
+	}
+	Change change;
+	change.sect = sect ? sect : "";
+	change.key = key ? key : "";
+	change.wholeSection = key == NULL;
+	pendingChanges.push_back(change);
+	if (batchDepth == 0) {
+		DispatchChanges();
+	}
+	return result;
+}
+
+static bool
+StartsWithNoCase(const std::string& s, const std::string& prefix)
+{
+	return prefix.size() <= s.size() && StringNoCaseCompare(s.c_str(), prefix.c_str(), prefix.size()) == 0;
+}
+
+bool
+Ini::Subscription::Matches(const Change& change) const
+{
+	if (prefix) {
+		return StartsWithNoCase(change.sect, sect) && (change.wholeSection || StartsWithNoCase(change.key, key));
+	}
+	if (StringNoCaseCompare(change.sect.c_str(), sect.c_str(), maxSectKeyLen)) {
+		return false;
+	}
+	return wholeSection || change.wholeSection || StringNoCaseCompare(change.key.c_str(), key.c_str(), maxSectKeyLen) == 0;
+}
+
+struct CompareChange {
+	bool operator() (const Ini::Change& a, const Ini::Change& b) const {
+		int r = StringNoCaseCompare(a.sect.c_str(), b.sect.c_str(), Ini::maxSectKeyLen);
+		if (r) {
+			return r < 0;
+		}
+		if (a.wholeSection != b.wholeSection) {
+			return a.wholeSection;
+		}
+		return StringNoCaseCompare(a.key.c_str(), b.key.c_str(), Ini::maxSectKeyLen) < 0;
+	}
+};
+
+struct SameChange {
+	bool operator() (const Ini::Change& a, const Ini::Change& b) const {
+		CompareChange less;
+		return !less(a, b) && !less(b, a);
+	}
+};
+
+void
+Ini::DispatchChanges()
+{
+	if (dispatching) {
+		return; //the outer dispatch loop picks them up
+	}
+	dispatching = true;
+	while (!pendingChanges.empty()) {
+		std::vector<Change> changes;
+		changes.swap(pendingChanges);
+		sort(changes.begin(), changes.end(), CompareChange());
+		changes.erase(unique(changes.begin(), changes.end(), SameChange()), changes.end());
+
+		//callbacks may subscribe or unsubscribe
+		std::vector<Subscription> subs = subscriptions;
+		std::vector<Change> matched;
+		for (std::vector<Subscription>::iterator sub = subs.begin(); sub != subs.end(); sub++) {
+			matched.clear();
+			for (std::vector<Change>::iterator change = changes.begin(); change != changes.end(); change++) {
+				if (sub->Matches(*change)) {
+					matched.push_back(*change);
+				}
+			}
+			if (!matched.empty()) {
+				sub->callback(this, &matched[0], matched.size(), sub->context);
+			}
+		}
+	}
+	dispatching = false;
+}
+
+//Builds the next version sharing the untouched sections with the previous one.
+//Call from the writer thread, then the readers see the new version at once.
+IniSnapshotPtr
+Ini::Publish()
+{
+	//Only the writer replaces the published one, so it is read without the hazard slot.
+	const IniSnapshotPtr* current = published.load();
+	IniSnapshotPtr prev = current ? *current : IniSnapshotPtr();
+	std::shared_ptr<IniSnapshot> next = std::make_shared<IniSnapshot>();
+	next->sects.reserve(sects.size());
+	next->version = ++publishedVersion;
+
+	//both are sorted, so walk them side by side
+	IniSnapshot::SectionList::const_iterator old = prev ? prev->sects.begin() : IniSnapshot::SectionList::const_iterator();
+	IniSnapshot::SectionList::const_iterator oldEnd = prev ? prev->sects.end() : old;
+	int reused = 0;
+	for (SectionList::iterator sect = sects.begin(); sect != sects.end(); sect++) {
+		while (old != oldEnd && StringNoCaseCompare((*old)->key, sect->key, maxSectKeyLen) < 0) {
+			old++;
+		}
+		if (!sect->dirty && old != oldEnd && StringNoCaseCompare((*old)->key, sect->key, maxSectKeyLen) == 0) {
+			next->sects.push_back(*old);
+			reused++;
+			continue;
+		}
+		std::shared_ptr<IniSnapshot::Section> s = std::make_shared<IniSnapshot::Section>();
+		size_t room = sect->keyLen + 1;
+		for (ItemList::iterator item = sect->items.begin(); item != sect->items.end(); item++) {
+			room += item->keyLen + 1 + item->valLen + 1;
+		}
+		s->pool.resize(room);
+		char* p = &s->pool[0];
+		memcpy(p, sect->key, sect->keyLen + 1);
+		s->key = p;
+		s->keyLen = sect->keyLen;
+		p += sect->keyLen + 1;
+		s->items.resize(sect->items.size());
+		IniSnapshot::Item* si = s->items.empty() ? NULL : &s->items[0];
+		for (ItemList::iterator item = sect->items.begin(); item != sect->items.end(); item++, si++) {
+			memcpy(p, item->key, item->keyLen + 1);
+			si->key = p;
+			si->keyLen = item->keyLen;
+			p += item->keyLen + 1;
+			memcpy(p, item->val, item->valLen);
+			p[item->valLen] = 0;
+			si->val = p;
+			si->valLen = item->valLen;
+			p += item->valLen + 1;
+		}
+		next->sects.push_back(s);
+		sect->dirty = false;
+	}
+	LOGD("%s : version %lu, %d of %d sections reused\n", __FUNCTION__, next->version, reused, sects.size());
+	IniSnapshotPtr result = next;
+	retiredSnapshots.reserve(retiredSnapshots.size() + 1);
+	current = published.exchange(new IniSnapshotPtr(result));
+	if (current) {
+		retiredSnapshots.push_back(current);
+	}
+	ReclaimSnapshots();
+	return result;
+}
+
+//Hazard slots of the GetSnapshot readers. A slot holds the published pointer being copied,
+//so the Publish doesn't free it under the reader.
+static const int snapshotHazardCount = 64;
+static std::atomic<const IniSnapshotPtr*> snapshotHazards[snapshotHazardCount];
+static std::atomic<unsigned int> nextSnapshotHazard(0);
+
+//Free the replaced published pointers which no reader holds in a slot.
+void
+Ini::ReclaimSnapshots()
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < retiredSnapshots.size(); i++) {
+		bool reading = false;
+		for (int slot = 0; slot < snapshotHazardCount && !reading; slot++) {
+			reading = snapshotHazards[slot].load() == retiredSnapshots[i];
+		}
+		if (reading) {
+			retiredSnapshots[kept++] = retiredSnapshots[i];
+		} else {
+			delete retiredSnapshots[i];
+		}
+	}
+	retiredSnapshots.resize(kept);
+}
+
+//Lock free for the readers, the shared_ptr is copied under a hazard slot. Returns NULL before the first Publish.
+IniSnapshotPtr
+Ini::GetSnapshot() const
+{
+	const IniSnapshotPtr* p = published.load();
+	if (p == NULL) {
+		return IniSnapshotPtr();
+	}
+	//Each thread starts at its own slot, and takes the next free one.
+	static thread_local unsigned int firstSlot = nextSnapshotHazard++;
+	unsigned int slot = firstSlot % snapshotHazardCount;
+	const IniSnapshotPtr* expected = NULL;
+	while (!snapshotHazards[slot].compare_exchange_weak(expected, p)) {
+		expected = NULL;
+		slot = (slot + 1) % snapshotHazardCount;
+	}
+	//The p may have been replaced and retired before the slot was set, then guard the new one.
+	const IniSnapshotPtr* now;
+	while ((now = published.load()) != p) {
+		p = now;
+		snapshotHazards[slot].store(p);
+	}
+	IniSnapshotPtr result = *p;
+	snapshotHazards[slot].store(NULL);
+	return result;
+}
+
+struct CompareSnapshotSection {
+	bool operator() (const IniSnapshot::SectionPtr& s, const char* key) const {
+		return StringNoCaseCompare(s->key, key, Ini::maxSectKeyLen) < 0;
+	}
+};
+
+struct CompareSnapshotItem {
+	bool operator() (const IniSnapshot::Item& item, const char* key) const {
+		return StringNoCaseCompare(item.key, key, Ini::maxSectKeyLen) < 0;
+	}
+};
+
+int
+IniSnapshot::GetItemCount() const
+{
+	int itemCount = 0;
+	for (SectionList::const_iterator sect = sects.begin(); sect != sects.end(); sect++) {
+		itemCount += (*sect)->items.size();
+	}
+	return itemCount;
+}
+
+int
+IniSnapshot::GetSectItemCount(const char* sect) const
+{
+	const Section* s = FindSection(sect);
+	return s ? s->items.size() : 0;
+}
+
+const IniSnapshot::Section*
+IniSnapshot::FindSection(const char* sect) const
+{
+	if (!sect) {
+		sect = "";
+	}
+	SectionList::const_iterator found = lower_bound(sects.begin(), sects.end(), sect, CompareSnapshotSection());
+	if (found == sects.end() || StringNoCaseCompare((*found)->key, sect, Ini::maxSectKeyLen)) {
+		return NULL;
+	}
+	return found->get();
+}
+
+const IniSnapshot::Item*
+IniSnapshot::FindItem(const char* sect, const char* key) const
+{
+	if (!key) {
+		return NULL;
+	}
+	const Section* s = FindSection(sect);
+	if (!s) {
+		return NULL;
+	}
+	std::vector<Item>::const_iterator found = lower_bound(s->items.begin(), s->items.end(), key, CompareSnapshotItem());
+	if (found == s->items.end() || StringNoCaseCompare(found->key, key, Ini::maxSectKeyLen)) {
+		return NULL;
+	}
+	return &*found;
+}
+
+const char*
+IniSnapshot::GetValueStr(const char* sect, const char* key, const char* _default) const
+{
+	const Item* item = FindItem(sect, key);
+	return item ? item->val : _default;
+}
+
+int
+IniSnapshot::GetValueInt(const char* sect, const char* key, int _default) const
+{
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return atoi(val);
+}
+
+long
+IniSnapshot::GetValueLong(const char* sect, const char* key, long _default) const
+{
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return strtol(val, NULL, 10);
+}
+
+double
+IniSnapshot::GetValueDouble(const char* sect, const char* key, double _default) const
+{
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return strtod(val, NULL);
+}
+
+IniWatcher::IniWatcher(Ini& ini, bool checkCRC) : ini(ini), checkCRC(checkCRC), fd(-1), wd(-1)
+{
+	baseName[0] = 0;
+}
+
+IniWatcher::~IniWatcher(void)
+{
+	Stop();
+}
+
+bool
+IniWatcher::Start()
+{
+	const char* fileName = ini.GetFileName();
+	if (*fileName == 0) {
+		LOGE("%s : no file name\n", __FUNCTION__);
+		return false;
+	}
+#if defined(__linux__)
+	Stop();
+	char dirName[256];
+	snprintf(dirName, sizeof(dirName), "%s", fileName);
+	char* slash = strrchr(dirName, '/');
+	if (slash) {
+		snprintf(baseName, sizeof(baseName), "%s", slash + 1);
+		if (slash == dirName) {
+			slash++;
+		}
+		*slash = 0;
+	} else {
+		snprintf(baseName, sizeof(baseName), "%s", fileName);
+		snprintf(dirName, sizeof(dirName), ".");
+	}
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1) {
+		LOGE("inotify_init1 : %s\n", strerror(errno));
+		return false;
+	}
+	wd = inotify_add_watch(fd, dirName, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd == -1) {
+		LOGE("inotify_add_watch : %s (%s)\n", dirName, strerror(errno));
+		Stop();
+		return false;
+	}
+	LOGD("%s : watching '%s' in '%s'\n", __FUNCTION__, baseName, dirName);
+#endif
+	return true;
+}
+
+void
+IniWatcher::Stop()
+{
+#if defined(__linux__)
+	if (fd != -1) {
+		close(fd);
+	}
+#endif
+	fd = -1;
+	wd = -1;
+}
+
+//Returns the number of changed items, 0 if nothing changed, -1 on error.
+int
+IniWatcher::Poll(int timeoutMs)
+{
+#if defined(__linux__)
+	if (fd == -1) {
+		return -1;
+	}
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	int r = poll(&pfd, 1, timeoutMs);
+	if (r <= 0) {
+		return r;
+	}
+	bool touched = false;
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(fd, events, sizeof(events))) > 0) {
+		for (char* p = events; p < events + len; ) {
+			struct inotify_event* event = (struct inotify_event*)p;
+			if (event->len && strcmp(event->name, baseName) == 0) {
+				touched = true;
+			}
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	if (!touched) {
+		return 0;
+	}
+#endif
+	return ini.ReloadFile(checkCRC);
+}
+
+#if defined(WIN32)
+RWLock::RWLock() { InitializeSRWLock(&lock); }
+RWLock::~RWLock() {}
+void RWLock::LockShared() { AcquireSRWLockShared(&lock); }
+void RWLock::UnlockShared() { ReleaseSRWLockShared(&lock); }
+void RWLock::Lock() { AcquireSRWLockExclusive(&lock); }
+void RWLock::Unlock() { ReleaseSRWLockExclusive(&lock); }
+#else
+RWLock::RWLock() { pthread_rwlock_init(&lock, NULL); }
+RWLock::~RWLock() { pthread_rwlock_destroy(&lock); }
+void RWLock::LockShared() { pthread_rwlock_rdlock(&lock); }
+void RWLock::UnlockShared() { pthread_rwlock_unlock(&lock); }
+void RWLock::Lock() { pthread_rwlock_wrlock(&lock); }
+void RWLock::Unlock() { pthread_rwlock_unlock(&lock); }
+#endif
+
+ConcurrentIni::ConcurrentIni(const int strpoolsize/*=64*1024*/) : Ini(strpoolsize)
+{
+	//Readers of the other sections keep reading while the pool grows.
+	pinPool = true;
+	writeBehind = NULL;
+}
+
+ConcurrentIni::~ConcurrentIni(void)
+{
+	StopWriteBehind();
+}
+
+//Writers hold one shard at a time, so locking all of them in order never deadlocks.
+void
+ConcurrentIni::LockAllShards()
+{
+	for (int i = 0; i < shardCount; i++) {
+		shardLocks[i].LockShared();
+	}
+}
+
+void
+ConcurrentIni::UnlockAllShards()
+{
+	for (int i = shardCount - 1; 0 <= i; i--) {
+		shardLocks[i].UnlockShared();
+	}
+}
+
+bool
+ConcurrentIni::LoadFile(const char* theFileName, bool checkCRC)
+{
+	RWLock::Guard layout(layoutLock);
+	return Ini::LoadFile(theFileName, checkCRC);
+}
+
+bool
+ConcurrentIni::SaveFile(const char* theFileName, bool writeCRC)
+{
+	RWLock::Guard save(saveLock);
+	RWLock::SharedGuard layout(layoutLock);
+	LockAllShards();
+	bool result = Ini::SaveFile(theFileName, writeCRC);
+	UnlockAllShards();
+	return result;
+}
+
+int
+ConcurrentIni::ReloadFile(bool checkCRC)
+{
+	RWLock::Guard layout(layoutLock);
+	return Ini::ReloadFile(checkCRC);
+}
+
+bool
+ConcurrentIni::FromString(const char* buf, size_t buflen, bool sorted)
+{
+	RWLock::Guard layout(layoutLock);
+	MarkDirty();
+	return Ini::FromString(buf, buflen, sorted);
+}
+
+string
+ConcurrentIni::ToString()
+{
+	RWLock::SharedGuard layout(layoutLock);
+	LockAllShards();
+	string str = Ini::ToString();
+	UnlockAllShards();
+	return str;
+}
+
+void
+ConcurrentIni::Reset()
+{
+	RWLock::Guard layout(layoutLock);
+	MarkDirty();
+	Ini::Reset();
+}
+
+int
+ConcurrentIni::GetSectCount()
+{
+	RWLock::SharedGuard layout(layoutLock);
+	return Ini::GetSectCount();
+}
+
+int
+ConcurrentIni::GetItemCount()
+{
+	RWLock::SharedGuard layout(layoutLock);
+	LockAllShards();
+	int itemCount = Ini::GetItemCount();
+	UnlockAllShards();
+	return itemCount;
+}
+
+int
+ConcurrentIni::GetSectItemCount(const char* sect)
+{
+	RWLock::SharedGuard layout(layoutLock);
+	SectionList::iterator foundSect = FindSection(sect ? sect : "");
+	if (foundSect == sects.end()) {
+		return 0;
+	}
+	RWLock::SharedGuard shard(ShardOf(foundSect));
+	return foundSect->items.size();
+}
+
+bool
+ConcurrentIni::IsSection(const char* sect)
+{
+	RWLock::SharedGuard layout(layoutLock);
+	return Ini::IsSection(sect);
+}
+
+bool
+ConcurrentIni::IsKey(const char* sect, const char* key)
+{
+	char buf[1];
+	return GetValueStrBuf(sect, key, buf, sizeof(buf), NULL);
+}
+
+//Returns false and copies the _default if the key is not found.
+bool
+ConcurrentIni::GetValueStrBuf(const char* sect, const char* key, char* buf, size_t bufSize, const char* _default)
+{
+	if (!sect) {
+		sect = "";
+	}
+	if (key) {
+		RWLock::SharedGuard layout(layoutLock);
+		SectionList::iterator foundSect = FindSection(sect);
+		if (foundSect != sects.end()) {
+			RWLock::SharedGuard shard(ShardOf(foundSect));
+			ItemList::iterator item = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
+			if (item != foundSect->items.end() && StringNoCaseCompare(item->key, key, maxSectKeyLen) == 0) {
+				if (bufSize) {
+					size_t len = min(item->valLen, bufSize - 1);
+					memcpy(buf, item->val, len);
+					buf[len] = 0;
 				}
+				return true;
 			}
-			sok = NULL;
-			sov = NULL;
 		}
-		result = true;
-	} while(0);
-	return result;
+	}
+	if (bufSize) {
+		snprintf(buf, bufSize, "%s", _default ? _default : "");
+	}
+	return false;
 }
 
 string
-Ini::ToString()
+ConcurrentIni::GetValueString(const char* sect, const char* key, const char* _default)
 {
-	string str;
-	SectionList::iterator finalSect = sects.empty() ? sects.end() : --sects.end();
-	for (SectionList::iterator sect=sects.begin(); sect!=sects.end(); sect++) {
-		if (*sect->key) {
-			str.push_back('[');
-			str.append(sect->key,sect->keyLen);
-			str.append("]" EOL,1+EOL_LEN);
-		}
-		ItemList::iterator finalItem = sect->items.empty() ? sect->items.end() : --sect->items.end();
-		for (ItemList::iterator item=sect->items.begin(); item!=sect->items.end(); item++) {
-			str.append(item->key,item->keyLen);
-			str.push_back('=');
-			str.append(item->val,item->valLen);
-			if (sect!=finalSect || item!=finalItem) {
-				str.append(EOL,EOL_LEN);
+	if (!sect) {
+		sect = "";
+	}
+	if (key) {
+		RWLock::SharedGuard layout(layoutLock);
+		SectionList::iterator foundSect = FindSection(sect);
+		if (foundSect != sects.end()) {
+			RWLock::SharedGuard shard(ShardOf(foundSect));
+			ItemList::iterator item = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
+			if (item != foundSect->items.end() && StringNoCaseCompare(item->key, key, maxSectKeyLen) == 0) {
+				return string(item->val, item->valLen);
 			}
 		}
-		if (sect!=finalSect) {
-			str.append(EOL,EOL_LEN);
-		}
-	}	
-	return str;
+	}
+	return string(_default ? _default : "");
 }
 
 int
-Ini::GetItemCount() 
+ConcurrentIni::GetValueInt(const char* sect, const char* key, int _default)
 {
-	int itemCount=0;	
-	for (SectionList::iterator sect=sects.begin(); sect!=sects.end(); sect++) {
-		itemCount += sect->items.size();
-	}	
-	return itemCount;
+	char val[64];
+	if (!GetValueStrBuf(sect, key, val, sizeof(val)) || *val == 0) {
+		return _default;
+	}
+	return atoi(val);
 }
 
-int 
-Ini::GetSectItemCount(const char* sect)
+long
+ConcurrentIni::GetValueLong(const char* sect, const char* key, long _default)
 {
-	SectionList::iterator foundSect = FindSection(sect);
-	if (foundSect != sects.end()) {
-		return foundSect->items.size();
+	char val[64];
+	if (!GetValueStrBuf(sect, key, val, sizeof(val)) || *val == 0) {
+		return _default;
+	}
+	return strtol(val, NULL, 10);
+}
+
+double
+ConcurrentIni::GetValueDouble(const char* sect, const char* key, double _default)
+{
+	char val[64];
+	if (!GetValueStrBuf(sect, key, val, sizeof(val)) || *val == 0) {
+		return _default;
+	}
+	return strtod(val, NULL);
+}
+
+//Update the existing section under its shard lock. The pool tail is shared by the shards.
+int
+ConcurrentIni::SetSectValueStr(SectionList::iterator sect, const char* key, const char* val)
+{
+	ItemList::iterator foundItem = lower_bound(sect->items.begin(), sect->items.end(), key, Item::Compare);
+	if (foundItem == sect->items.end() || StringNoCaseCompare(foundItem->key, key, maxSectKeyLen)) {
+		Item newItem;
+		{
+			RWLock::Guard pool(poolLock);
+			if (CreateItem(newItem, key, val)) {
+				return 1;
+			}
+		}
+		sect->items.insert(foundItem, newItem);
+		sect->dirty = true;
+		MarkDirty();
+		return 0;
 	}
+	size_t valLen = strlen(val);
+	if (foundItem->valLen == valLen && memcmp(foundItem->val, val, valLen) == 0) {
+		LOGD("Unchanged item : '%s'='%s'\n", key, val);
+		return 0;
+	}
+	LOGD("Update item : '%s'='%s'\n", key, val);
+	sect->dirty = true;
+	MarkDirty();
+	if (valLen + 1 <= foundItem->valRoom) {
+		memcpy((void*)foundItem->val, val, valLen + 1);
+		foundItem->valLen = valLen;
+		RWLock::Guard pool(poolLock);
+		contentsChanged = true;
+		return 0;
+	}
+	RWLock::Guard pool(poolLock);
+	const char* newVal = PushString(val);
+	if (newVal == NULL) {
+		return 1;
+	}
+	foundItem->val = newVal;
+	foundItem->valLen = valLen;
+	foundItem->valRoom = valLen + 1;
+	contentsChanged = true;
 	return 0;
 }
 
-Ini::SectionList::iterator
-Ini::FindSection(const char* sect)
+int
+ConcurrentIni::SetValueStr(const char* sect, const char* key, const char* val)
 {
-	SectionList::iterator foundSect = lower_bound(sects.begin(), sects.end(), sect, Section::Compare);	
-	if (foundSect==sects.end()) {
-		LOGD("Section not found : '%s'\n", sect);
-		return sects.end();
-	} else {
-		if (StringNoCaseCompare(foundSect->key, sect, maxSectKeyLen)) {
-			LOGD("Section not found : '%s'\n", foundSect->key);
-			return sects.end();
-		} else {
-			LOGD("Section exist : '%s'\n", foundSect->key);
-			return foundSect;
+	if (!sect) {
+		sect = "";
+	}
+	if (!key || !val) {
+		return 1;
+	}
+	{
+		RWLock::SharedGuard layout(layoutLock);
+		SectionList::iterator foundSect = FindSection(sect);
+		if (foundSect != sects.end()) {
+			RWLock::Guard shard(ShardOf(foundSect));
+			try {
+				return SetSectValueStr(foundSect, key, val);
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+				return 1;
+			}
 		}
 	}
+	//New section moves the others, so lock the whole layout.
+	RWLock::Guard layout(layoutLock);
+	int result = Ini::SetValueStr(sect, key, val);
+	if (result == 0) {
+		MarkDirty();
+	}
+	return result;
 }
 
-Ini::ItemList::iterator
-Ini::FindItem(const char* sect, const char*key)
+void
+ConcurrentIni::SetValueInt(const char* sect, const char* key, int val)
 {
-	SectionList::iterator foundSect = FindSection(sect);
-	if (foundSect==sects.end()) {
-		//return NULL;
-		return emptySection.items.end();//for gpp - 140103
+	char buf[100];
+	snprintf(buf, sizeof(buf), "%d", val);
+	SetValueStr(sect, key, buf);
+}
+
+void
+ConcurrentIni::SetValueLong(const char* sect, const char* key, long val)
+{
+	char buf[100];
+	snprintf(buf, sizeof(buf), "%ld", val);
+	SetValueStr(sect, key, buf);
+}
+
+void
+ConcurrentIni::SetValueDouble(const char* sect, const char* key, double val)
+{
+	char buf[100];
+	snprintf(buf, sizeof(buf), "%0.7f", val);
+	SetValueStr(sect, key, buf);
+}
+
+//Background saver of the ConcurrentIni write-behind.
+//The setters only bump the dirty count, the thread polls it every quiet period.
+class WriteBehind
+{
+	ConcurrentIni& ini;
+	std::string fileName;
+	int quietMs;
+	int maxDirty;
+	int maxDelayMs;
+	bool writeCRC;
+	std::atomic<int> dirty;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable flushed;
+	unsigned long flushRequest;
+	unsigned long flushDone;
+	bool flushResult;
+	bool stopping;
+	std::thread thread;
+
+	void Run()
+	{
+		unique_lock<mutex> guard(lock);
+		int seen = 0;
+		chrono::steady_clock::time_point firstDirty;
+		for (;;) {
+			if (flushRequest == flushDone && !stopping) {
+				wake.wait_for(guard, chrono::milliseconds(quietMs));
+			}
+			unsigned long request = flushRequest;
+			bool exiting = stopping;
+			int count = dirty.load();
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+			if (count && !seen) {
+				firstDirty = now;
+			}
+			bool save = count && (request != flushDone || exiting || count == seen || maxDirty <= count
+				|| chrono::milliseconds(maxDelayMs) <= now - firstDirty);
+			seen = count;
+			bool result = true;
+			if (save) {
+				guard.unlock();
+				//The changes from now on are counted for the next save.
+				dirty.fetch_sub(count);
+				result = ini.SaveSnapshot(fileName.c_str(), writeCRC);
+				if (!result) {
+					dirty.fetch_add(count);
+				}
+				guard.lock();
+				seen = dirty.load();
+				firstDirty = chrono::steady_clock::now();
+			}
+			if (request != flushDone) {
+				flushDone = request;
+				flushResult = result;
+				flushed.notify_all();
+			}
+			if (exiting) {
+				break;
+			}
+		}
 	}
-	ItemList::iterator foundItem = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
-	if (foundItem==foundSect->items.end()) {
-		LOGD("Item not found : '%s'\n", key);
-		return foundSect->items.end();
-	} else {
-		if (StringNoCaseCompare(foundItem->key, key, maxSectKeyLen)) {
-			LOGD("Item not found : '%s'\n", key);
-			return foundSect->items.end();
-		} else {
-			LOGD("Item exist : '%s'='%s'\n", key, foundItem->val);
-			return foundItem;
+public:
+	WriteBehind(ConcurrentIni& ini, const char* fileName, int quietMs, int maxDirty, int maxDelayMs, bool writeCRC)
+		: ini(ini), fileName(fileName), quietMs(max(quietMs, 1)), maxDirty(max(maxDirty, 1)), maxDelayMs(maxDelayMs), writeCRC(writeCRC),
+		dirty(0), flushRequest(0), flushDone(0), flushResult(true), stopping(false)
+	{
+		thread = std::thread(&WriteBehind::Run, this);
+	}
+	~WriteBehind()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+	inline void Changed()
+	{
+		if (dirty.fetch_add(1, memory_order_relaxed) + 1 == maxDirty) {
+			wake.notify_one();
+		}
+	}
+	//Saves the pending changes and waits for the disk.
+	bool Flush()
+	{
+		unique_lock<mutex> guard(lock);
+		unsigned long ticket = ++flushRequest;
+		wake.notify_one();
+		while (flushDone < ticket) {
+			flushed.wait(guard);
 		}
+		return flushResult;
+	}
+};
+
+void
+ConcurrentIni::MarkDirty()
+{
+	if (writeBehind) {
+		writeBehind->Changed();
 	}
 }
 
-const char*
-Ini::FindFirstSection()
+//Serialize under the shared locks and write without them, so the setters never wait for the disk.
+bool
+ConcurrentIni::SaveSnapshot(const char* fileName, bool writeCRC)
 {
-	lastFoundSectionFFS = sects.end();
-	if (!sects.empty()) {
-		lastFoundSectionFFS = sects.begin();
-		return lastFoundSectionFFS->key;
+	IniString str;
+	bool serialized = true;
+	{
+		RWLock::SharedGuard layout(layoutLock);
+		LockAllShards();
+		try {
+			size_t sect = 0;
+			size_t item = 0;
+			Serialize(sect, item, str, (size_t)-1);
+		} catch (const std::bad_alloc&) {
+			serialized = false;
+		}
+		UnlockAllShards();
 	}
-	return NULL;
+	if (!serialized) {
+		LOGE("%s : out of memory : %s\n", __FUNCTION__, fileName);
+		return false;
+	}
+	char crc32str[crc32StrSize + 1] = { 0 };
+	RWLock::Guard save(saveLock);
+	if (!WriteFile(fileName, str.data(), str.size(), writeCRC, crc32str)) {
+		return false;
+	}
+	//Our own save shall not trigger the ReloadFile.
+	RWLock::SharedGuard layout(layoutLock);
+	if (0 == strcmp(fileName, iniFileName)) {
+		UpdateFileStamp(crc32str);
+	}
+	return true;
 }
 
-const char*
-Ini::FindNextSection()
+bool
+ConcurrentIni::StartWriteBehind(const char* fileName, int quietMs, int maxDirty, int maxDelayMs, bool writeCRC)
 {
-	if (lastFoundSectionFFS==sects.end()) {
-		return NULL;
+	if (writeBehind) {
+		LOGE("Write-behind is already started\n");
+		return false;
 	}
-	lastFoundSectionFFS++;
-	if (lastFoundSectionFFS==sects.end()) {
-		return NULL;
+	if (fileName == NULL) {
+		fileName = iniFileName;
 	}
-	return lastFoundSectionFFS->key;
+	if (*fileName == 0) {
+		LOGE("No file name for the write-behind\n");
+		return false;
+	}
+	writeBehind = new (nothrow) WriteBehind(*this, fileName, quietMs, maxDirty, maxDelayMs, writeCRC);
+	return writeBehind != NULL;
 }
 
-int
-Ini::FindFirstKey(const char* sect, const char** key, const char** val)
+//Saves the pending changes now and returns after they are on the disk.
+bool
+ConcurrentIni::Flush()
 {
-	lastFoundSectionFFK = sects.end();
-	if (!sect) { //+allow empty section - 160531
-		sect = "";
-	}		
-	if (!key || !val) {
-		return 0;
-	}	
-	if (sects.empty()) {
-		return 0;
+	if (writeBehind == NULL) {
+		return true;
 	}
-	SectionList::iterator foundSect = FindSection(sect);
-	if (foundSect == sects.end()) {
-		return 0;
+	return writeBehind->Flush();
+}
+
+//Saves the pending changes and stops the background thread.
+void
+ConcurrentIni::StopWriteBehind()
+{
+	if (writeBehind) {
+		delete writeBehind;
+		writeBehind = NULL;
 	}
-	if (foundSect->items.empty()) {
-		return 0;
+}
+
+IniLoader::IniLoader()
+{
+	wallSec = 0;
+}
+
+IniLoader::~IniLoader(void)
+{
+	Clear();
+}
+
+void
+IniLoader::Clear()
+{
+	for (size_t i = 0; i < results.size(); i++) {
+		delete results[i].ini;
 	}
-	lastFoundSectionFFK = foundSect;
-	lastFoundItemFFK = foundSect->items.begin();
-	*key = lastFoundItemFFK->key;
-	*val = lastFoundItemFFK->val;
-	return (int)foundSect->items.size();
+	results.clear();
+	wallSec = 0;
+}
+
+//Last error logged by this thread, without the time stamp and the EOL of the log.
+static std::string
+LastError()
+{
+	const char* found = strstr(lastError, "[INI]");
+	std::string error = found ? found + strlen("[INI]") : lastError;
+	while (!error.empty() && (error[error.size() - 1] == '\n' || error[error.size() - 1] == '\r')) {
+		error.erase(error.size() - 1);
+	}
+	return error;
+}
+
+void
+IniLoader::LoadOne(Result& result, bool checkCRC)
+{
+	lastError[0] = 0;
+	unsigned long long start = StatNowNs();
+	size_t fileSize = 0;
+	char* buf = Ini::ReadFile(result.path.c_str(), fileSize);
+	result.readSec = (StatNowNs() - start) / 1e9;
+	if (buf) {
+		Ini* ini = new (nothrow) Ini();
+		unsigned long long phaseNs[2] = { 0, 0 };
+		if (ini == NULL) {
+			IniFree(buf);
+		} else if (ini->LoadBuffer(result.path.c_str(), buf, fileSize, checkCRC, NULL, phaseNs, true)) {
+			result.ini = ini;
+		} else {
+			delete ini;
+		}
+		result.crcSec = phaseNs[0] / 1e9;
+		result.parseSec = phaseNs[1] / 1e9;
+	}
+	if (result.ini == NULL) {
+		result.error = LastError();
+		if (result.error.empty()) {
+			result.error = "load failed";
+		}
+	}
+}
+
+//The read and the CRC are interleaved by the streaming, so the time goes to the crcSec.
+void
+IniLoader::ValidateOne(Result& result)
+{
+	lastError[0] = 0;
+	unsigned long long start = StatNowNs();
+	if (!Ini::ValidateFile(result.path.c_str())) {
+		result.error = LastError();
+		if (result.error.empty()) {
+			result.error = "validate failed";
+		}
+	}
+	result.crcSec = (StatNowNs() - start) / 1e9;
 }
 
 int
-Ini::FindNextKey(const char** key, const char** val)
+IniLoader::Run(const std::vector<std::string>& paths, int threads, const std::function<void(Result&)>& job)
 {
-	if (!key || !val) {
-		return 0;
+	Clear();
+	results.resize(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) {
+		results[i].path = paths[i];
+		results[i].ini = NULL;
+		results[i].readSec = results[i].crcSec = results[i].parseSec = 0;
 	}
-	if (lastFoundSectionFFK == sects.end()) {
-		return 0;
+	if (threads <= 0) {
+		threads = max(std::thread::hardware_concurrency(), 1U);
+	}
+	threads = (int)min((size_t)threads, max(paths.size(), (size_t)1));
+
+	//The threads take the next file by turns, so a big file doesn't hold up the others.
+	unsigned long long start = StatNowNs();
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	for (int t = 1; t < threads; t++) {
+		workers.push_back(std::thread([this, &next, &job]() {
+			for (size_t i; (i = next++) < results.size(); ) {
+				job(results[i]);
+			}
+		}));
 	}
-	if (lastFoundItemFFK == lastFoundSectionFFK->items.end()) {	
-		LOGD("%s End of item (1)\n", __FUNCTION__);
-		return 0;
+	for (size_t i; (i = next++) < results.size(); ) {
+		job(results[i]);
 	}
-	if (++lastFoundItemFFK == lastFoundSectionFFK->items.end()) {
-		LOGD("%s End of item (2)\n", __FUNCTION__);
-		return 0;
+	for (size_t t = 0; t < workers.size(); t++) {
+		workers[t].join();
 	}
-	*key = lastFoundItemFFK->key;
-	*val = lastFoundItemFFK->val;
-	return 1;
+	wallSec = (StatNowNs() - start) / 1e9;
+	LOGD("%s : %d files, %d failed, %d threads, %.3lf seconds\n", __FUNCTION__, results.size(), GetErrorCount(), threads, wallSec);
+	return GetErrorCount();
 }
 
-bool
-Ini::IsSection(const char* sect)
+int
+IniLoader::LoadFiles(const std::vector<std::string>& paths, bool checkCRC, int threads)
 {
-//--- allow empty section - 160531
-//	if (!sect) {
-//		return false;
-//	}
-//---
-	return FindSection(sect) != sects.end();
+	return Run(paths, threads, [this, checkCRC](Result& result) { LoadOne(result, checkCRC); });
+}
+
+int
+IniLoader::ValidateFiles(const std::vector<std::string>& paths, int threads)
+{
+	return Run(paths, threads, [this](Result& result) { ValidateOne(result); });
 }
 
+//The files in the dir having the suffix, in the name order. Sub directories are not searched.
 bool
-Ini::IsKey(const char* sect, const char* key)
+IniLoader::ListDir(const char* dir, const char* suffix, std::vector<std::string>& paths)
 {
-	if (!sect) { //+allow empty section - 160531
-		sect = "";
-	}	
-	if (!key) {
+	size_t suffixLen = suffix ? strlen(suffix) : 0;
+#if defined(WIN32)
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((std::string(dir) + "\\*").c_str(), &found);
+	if (find == INVALID_HANDLE_VALUE) {
+		LOGE("FindFirstFile : %s (%lu)\n", dir, GetLastError());
 		return false;
 	}
-	SectionList::iterator foundSect = FindSection(sect);
-	if (foundSect==sects.end()) {
+	do {
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			continue;
+		}
+		size_t nameLen = strlen(found.cFileName);
+		if (suffixLen <= nameLen && 0 == StringNoCaseCompare(found.cFileName + nameLen - suffixLen, suffix, suffixLen)) {
+			paths.push_back(std::string(dir) + "\\" + found.cFileName);
+		}
+	} while (FindNextFileA(find, &found));
+	FindClose(find);
+#else
+	DIR* d = opendir(dir);
+	if (d == NULL) {
+		LOGE("opendir : %s (%s)\n", dir, strerror(errno));
 		return false;
 	}
-	ItemList::iterator foundItem = FindItem(sect,key);
-	//return foundItem!=foundSect->items.end() && foundItem!=NULL;
-	return foundItem!=emptySection.items.end() && foundItem!=foundSect->items.end();//for gpp - 140103
+	for (struct dirent* entry; (entry = readdir(d)) != NULL; ) {
+		size_t nameLen = strlen(entry->d_name);
+		if (suffixLen <= nameLen && 0 == StringNoCaseCompare(entry->d_name + nameLen - suffixLen, suffix, suffixLen)) {
+			std::string path = std::string(dir) + "/" + entry->d_name;
+			struct stat fileStat;
+			if (stat(path.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode)) {
+				paths.push_back(path);
+			}
+		}
+	}
+	closedir(d);
+#endif
+	sort(paths.begin(), paths.end());
+	return true;
 }
 
-const char*
-Ini::GetValueStr(const char* sect, const char* key, const char* _default)
+int
+IniLoader::LoadDir(const char* dir, const char* suffix, bool checkCRC, int threads)
 {
-	if (!sect) { //+allow empty section - 160531
-		sect = "";
-	}	
-	if (!key) {
-		return _default;
-	}
-	if (sects.empty()) {
-		return _default;
+	std::vector<std::string> paths;
+	if (!ListDir(dir, suffix, paths)) {
+		Clear();
+		return -1;
 	}
-	SectionList::iterator foundSect = FindSection(sect);
-	if (foundSect==sects.end()) {
-		return _default;
+	return LoadFiles(paths, checkCRC, threads);
+}
+
+int
+IniLoader::ValidateDir(const char* dir, const char* suffix, int threads)
+{
+	std::vector<std::string> paths;
+	if (!ListDir(dir, suffix, paths)) {
+		Clear();
+		return -1;
 	}
-	ItemList::iterator item = FindItem(sect,key);
-	if (item==foundSect->items.end()) {
-		return _default;
+	return ValidateFiles(paths, threads);
+}
+
+//The caller owns the returned Ini.
+Ini*
+IniLoader::Release(size_t i)
+{
+	Ini* ini = results[i].ini;
+	results[i].ini = NULL;
+	return ini;
+}
+
+int
+IniLoader::GetErrorCount() const
+{
+	int errors = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		errors += !results[i].error.empty();
 	}
-	return item->val;
+	return errors;
 }
 
 void
-Ini::GetValueStrBuf(const char* sect, const char* key, char* strBuf, size_t bufSize, const char* _default)
+IniLoader::GetTimes(double& wallSec, double& readSec, double& crcSec, double& parseSec) const
 {
-	strBuf[0]=0;
-	const char* str=GetValueStr(sect, key);
-	if (str==NULL) {
-		memset(strBuf, 0, bufSize);
-		return;
+	wallSec = this->wallSec;
+	readSec = crcSec = parseSec = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		readSec += results[i].readSec;
+		crcSec += results[i].crcSec;
+		parseSec += results[i].parseSec;
 	}
-	snprintf(strBuf, bufSize, "%s", str);
 }
 
-int
-Ini::GetValueInt(const char* sect, const char* key, int _default)
+void
+IniOverlay::AddLayer(const Ini& ini)
 {
-	const char* val = GetValueStr(sect,key);
-	if (val == NULL || *val == 0) {
-		return _default;
+	layers.push_back(&ini);
+	cacheValid = false;
+}
+
+void
+IniOverlay::Clear()
+{
+	layers.clear();
+	cacheValid = false;
+}
+
+//Looking up the keys of the same section in a row, only the first one searches the sections of the layers.
+const std::vector<const IniOverlay::Section*>&
+IniOverlay::FindSections(const char* sect)
+{
+	if (!sect) {
+		sect = "";
 	}
-	return atoi(val);
+	if (cacheValid && 0 == StringNoCaseCompare(cachedSect.c_str(), sect, Ini::maxSectKeyLen)) {
+		return cachedSects;
+	}
+	cachedSects.resize(layers.size());
+	for (size_t i = 0; i < layers.size(); i++) {
+		Ini::SectionRange range = layers[i]->Sections();
+		Ini::SectionRange::const_iterator found = lower_bound(range.begin(), range.end(), sect, Section::Compare);
+		cachedSects[i] = (found == range.end() || StringNoCaseCompare(found->key, sect, Ini::maxSectKeyLen)) ? NULL : &*found;
+	}
+	cachedSect = sect;
+	cacheValid = true;
+	return cachedSects;
 }
 
-unsigned int
-Ini::GetValueUInt(const char* sect, const char* key, unsigned int _default)
+const IniOverlay::Item*
+IniOverlay::FindItem(const char* sect, const char* key, int* layer)
 {
-	const char* val = GetValueStr(sect,key);
-	if (val == NULL || *val == 0) {
-		return _default;
+	if (!key) {
+		return NULL;
 	}
-	char *endptr;
-	return strtoul(val, &endptr, 10);
+	const std::vector<const Section*>& found = FindSections(sect);
+	for (size_t i = found.size(); i-- > 0; ) {
+		if (found[i] == NULL) {
+			continue;
+		}
+		const Ini::ItemList& items = found[i]->items;
+		Ini::ItemList::const_iterator item = lower_bound(items.begin(), items.end(), key, Item::Compare);
+		if (item != items.end() && 0 == StringNoCaseCompare(item->key, key, Ini::maxSectKeyLen)) {
+			if (layer) {
+				*layer = (int)i;
+			}
+			return &*item;
+		}
+	}
+	return NULL;
 }
 
-long
-Ini::GetValueLong(const char* sect, const char* key, long _default/*=0*/)
+bool
+IniOverlay::IsSection(const char* sect)
 {
-	const char* val = GetValueStr(sect,key);
-	if (val == NULL || *val == 0) {
-		return _default;
+	const std::vector<const Section*>& found = FindSections(sect);
+	for (size_t i = 0; i < found.size(); i++) {
+		if (found[i]) {
+			return true;
+		}
 	}
-	char *endptr;
-	return strtol(val, &endptr, 10);
+	return false;
 }
 
-unsigned long
-Ini::GetValueULong(const char* sect, const char* key, unsigned long _default)
+const char*
+IniOverlay::GetValueStr(const char* sect, const char* key, const char* _default)
 {
-	const char* val = GetValueStr(sect,key);
+	const Item* item = FindItem(sect, key);
+	return item ? item->val : _default;
+}
+
+int
+IniOverlay::GetValueInt(const char* sect, const char* key, int _default)
+{
+	const char* val = GetValueStr(sect, key, NULL);
 	if (val == NULL || *val == 0) {
 		return _default;
 	}
-	char *endptr;
-	return strtoul(val, &endptr, 10);
+	return atoi(val);
 }
 
-float
-Ini::GetValueFloat(const char* sect, const char* key, float _default/*=0.0*/)
+long
+IniOverlay::GetValueLong(const char* sect, const char* key, long _default)
 {
-	const char* val=GetValueStr(sect,key);
+	const char* val = GetValueStr(sect, key, NULL);
 	if (val == NULL || *val == 0) {
 		return _default;
 	}
-	char* endptr;
-	return strtof(val,&endptr);
+	return strtol(val, NULL, 10);
 }
 
 double
-Ini::GetValueDouble(const char* sect, const char* key, double _default/*=0.0*/)
+IniOverlay::GetValueDouble(const char* sect, const char* key, double _default)
 {
-	const char* val=GetValueStr(sect,key);
+	const char* val = GetValueStr(sect, key, NULL);
 	if (val == NULL || *val == 0) {
 		return _default;
 	}
-	char* endptr;
-	return strtod(val,&endptr);
+	return strtod(val, NULL);
 }
 
-char*
-Ini::ByteArrayToHexString(const unsigned char* byteArray, size_t sizeByteArray)
+//k-way merge of the sorted sections of the layers.
+//There are a few layers, so a scan for the least head is cheaper than a heap.
+void
+IniOverlay::GetSections(std::vector<const char*>& sections) const
 {
-	//00 AB CD ...
-	char* s=(char*)malloc(3*sizeByteArray); //Last blank for the null character.
-	if (s==NULL) {
-		return NULL;
+	sections.clear();
+	std::vector<Ini::SectionRange> ranges;
+	for (size_t i = 0; i < layers.size(); i++) {
+		ranges.push_back(layers[i]->Sections());
 	}
-	const unsigned char* p=byteArray;
-	char *q=s;
-	//LOGD("ByteArrayToHexString : length=%d, byteArray=", sizeByteArray);
-	for(unsigned int i=0; i<sizeByteArray; i++) {
-		//LOGD("%02X ",(unsigned char)*p);
-		if (*p>=16) *q = *p/16 >= 10 ? ('A' + *p/16 - 10) : '0' + *p/16;
-		else *q='0';
-		q++;
-		if (*p%16) *q = *p%16 >= 10 ? ('A' + *p%16 - 10) : ('0' + *p%16);
-		else *q = '0';
-		q++;
-		if (i+1==sizeByteArray) { 
-			*q=0; 
-			break; 
+	std::vector<size_t> pos(layers.size(), 0);
+	for (;;) {
+		//From the top, so the name of the upper layer is kept on the tie.
+		const char* least = NULL;
+		for (size_t i = layers.size(); i-- > 0; ) {
+			if (pos[i] < ranges[i].size() && (least == NULL || StringNoCaseCompare(ranges[i][pos[i]].key, least, Ini::maxSectKeyLen) < 0)) {
+				least = ranges[i][pos[i]].key;
+			}
+		}
+		if (least == NULL) {
+			break;
+		}
+		sections.push_back(least);
+		for (size_t i = 0; i < layers.size(); i++) {
+			if (pos[i] < ranges[i].size() && 0 == StringNoCaseCompare(ranges[i][pos[i]].key, least, Ini::maxSectKeyLen)) {
+				pos[i]++;
+			}
 		}
-		*q++ = ' ';
-		p++;
 	}
-	//LOGD("\n");
-	return s;
 }
 
-int
-Ini::HexStringToByteArray(const char* hexString, unsigned char* byteArray, size_t sizeByteArray)
+//k-way merge of the sorted items of the section in the layers.
+void
+IniOverlay::GetItems(const char* sect, std::vector<const Item*>& items)
 {
-	int hexStrLen = strlen(hexString);
-	const char* p = hexString;
-	const char* e = p + hexStrLen;
-	//LOGD("HexStringToByteArray : strlength=%d, sizeByteArray=%d\n", hexStrLen,sizeByteArray);
-	if (!byteArray) {
-		return 0;
-	}
-	unsigned char* bp=byteArray;
-	while(p<e && (unsigned int)(bp-byteArray) < sizeByteArray) {
-		//LOGD("%02X ",(unsigned char)*p);
-		unsigned char h=0;
-		/***/if ('0'<=*p && *p<='9') h = *p-'0';
-		else if ('A'<=*p && *p<='F') h = *p-'A'+10;
-		else if ('a'<=*p && *p<='f') h = *p-'a'+10;
-		else break;
-		p++;
-		unsigned char l=0;
-		//LOGD("%02X ",(unsigned char)*p);
-		/***/if ('0'<=*p && *p<='9') l = *p-'0';
-		else if ('A'<=*p && *p<='F') l = *p-'A'+10;
-		else if ('a'<=*p && *p<='f') l = *p-'a'+10;
-		else { l=h; h=0; }
-		p++;
-		*bp++ = 16*h + l;
-		while (*p==' ' && p<e) {
-			//LOGD("%02X ",(unsigned char)*p);
-			p++;
+	items.clear();
+	const std::vector<const Section*>& found = FindSections(sect);
+	std::vector<size_t> pos(found.size(), 0);
+	for (;;) {
+		const Item* least = NULL;
+		for (size_t i = found.size(); i-- > 0; ) {
+			if (found[i] && pos[i] < found[i]->items.size() && (least == NULL || StringNoCaseCompare(found[i]->items[pos[i]].key, least->key, Ini::maxSectKeyLen) < 0)) {
+				least = &found[i]->items[pos[i]];
+			}
 		}
-		if (*p==0) {
+		if (least == NULL) {
 			break;
 		}
+		items.push_back(least);
+		for (size_t i = 0; i < found.size(); i++) {
+			if (found[i] && pos[i] < found[i]->items.size() && 0 == StringNoCaseCompare(found[i]->items[pos[i]].key, least->key, Ini::maxSectKeyLen)) {
+				pos[i]++;
+			}
+		}
 	}
-	return bp-byteArray;
+}
+
+CompactIni::CompactIni() : garbage(0), contentsChanged(false)
+{
+	Reset();
 }
 
 void
-Ini::GetValueRaw(const char* sect, const char* key, void* byteArray, const size_t sizeByteArray, unsigned char _default/*=0x00*/)
+CompactIni::Reset()
 {
-	const char* hexString=GetValueStr(sect, key, NULL);
-	if (hexString && *hexString) {
-		HexStringToByteArray(hexString, (unsigned char*)byteArray, sizeByteArray);
-	} else {
-		memset(byteArray,_default,sizeByteArray);
+	decltype(pool)().swap(pool);
+	SectionList().swap(sects);
+	ItemList().swap(items);
+	garbage = 0;
+	contentsChanged = false;
+	try {
+		pool.push_back(0);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory for the pool\n", __FUNCTION__);
 	}
 }
 
-void
-Ini::SetValueRaw(const char* sect, const char* key, const void* byteArray, const size_t sizeByteArray)
+bool
+CompactIni::PushString(const char* str, size_t len, unsigned int& offset)
 {
-	if (sizeByteArray==0) {
-		SetValueStr(sect, key, "");
-		return;
+	if (0xFFFFFFFFULL < (unsigned long long)pool.size() + len + 2) {
+		LOGE("%s : the pool is over 4GB\n", __FUNCTION__);
+		return false;
 	}
-	char* hexString = ByteArrayToHexString((unsigned char*)byteArray, sizeByteArray);
-	if (hexString!=NULL) {
-		SetValueStr(sect, key, hexString);
-		free(hexString);
-		hexString = NULL;
+	size_t size = pool.size();
+	try {
+		if (pool.empty()) {
+			pool.push_back(0);
+		}
+		offset = (unsigned int)pool.size();
+		pool.insert(pool.end(), str, str + len);
+		pool.push_back(0);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory\n", __FUNCTION__);
+		pool.resize(size);
+		return false;
 	}
+	return true;
 }
 
-void
-Ini::SetValueStrBuf(const char* sect, const char* key, char* buf, size_t bufSize)
+//Sized once from the Ini, so the pool and the vectors have no spare room.
+bool
+CompactIni::Assign(const Ini& ini)
 {
-	char* dupString = (char*)malloc(bufSize);
-	if (!dupString) {
-		return;
+	Reset();
+	Ini::SectionRange range = ini.Sections();
+	size_t poolSize = 1;
+	size_t itemCount = 0;
+	for (Ini::SectionRange::const_iterator s = range.begin(); s != range.end(); s++) {
+		poolSize += s->keyLen + 1;
+		itemCount += s->items.size();
+		for (Ini::ItemList::const_iterator i = s->items.begin(); i != s->items.end(); i++) {
+			poolSize += i->keyLen + 1 + i->valLen + 1;
+		}
 	}
-	snprintf(dupString,bufSize,"%s",buf);
-	SetValueStr(sect,key,dupString);
-	free(dupString);
-	dupString = NULL;
+	if (0xFFFFFFFFULL < (unsigned long long)poolSize) {
+		LOGE("%s : the pool is over 4GB\n", __FUNCTION__);
+		return false;
+	}
+	try {
+		pool.reserve(poolSize);
+		sects.reserve(range.size());
+		items.reserve(itemCount);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory, %d bytes of strings and %d items\n", __FUNCTION__, poolSize, itemCount);
+		Reset();
+		return false;
+	}
+	//Nothing allocates any more, all is reserved.
+	for (Ini::SectionRange::const_iterator s = range.begin(); s != range.end(); s++) {
+		Section sect;
+		PushString(s->key, s->keyLen, sect.key);
+		sect.keyLen = (unsigned int)s->keyLen;
+		sect.first = (unsigned int)items.size();
+		sect.count = (unsigned int)s->items.size();
+		for (Ini::ItemList::const_iterator i = s->items.begin(); i != s->items.end(); i++) {
+			Item item;
+			PushString(i->key, i->keyLen, item.key);
+			item.keyLen = (unsigned int)i->keyLen;
+			PushString(i->val, i->valLen, item.val);
+			item.valLen = (unsigned int)i->valLen;
+			items.push_back(item);
+		}
+		sects.push_back(sect);
+	}
+	contentsChanged = true;
+	return true;
 }
 
-int
-Ini::CreateItem(Item& newItem, const char* key, const char* val) 
+bool
+CompactIni::LoadFile(const char* iniFileName, bool checkCRC)
 {
-	LOGD("Create item : '%s'='%s'\n", key, val);
-	newItem.key = PushString(key);
-	newItem.keyLen = strlen(key);
-	newItem.val = PushString(val);
-	newItem.valLen = strlen(val);
-	newItem.valRoom = newItem.valLen + 1;
-
-	if (newItem.key != NULL && newItem.val != NULL) {
-		contentsChanged = true;
-		return 0;
-	} else {
-		return 1;
+	size_t fileSize = 0;
+	char* buf = Ini::ReadFile(iniFileName, fileSize);
+	if (buf == NULL) {
+		return false;
+	}
+	bool result = false;
+	{
+		//The tokens stay in the adopted buf.
+		Ini ini(1024);
+		result = ini.LoadBuffer(iniFileName, buf, fileSize, checkCRC, NULL, NULL, true) && Assign(ini);
 	}
+	if (result) {
+		contentsChanged = false;
+	}
+	return result;
 }
 
-int
-Ini::SetValueStr(const char* sect, const char* key, const char* val, bool sortedFile /*= false*/)
+bool
+CompactIni::SaveFile(const char* iniFileName, bool writeCRC)
 {
-	if (!sect) { //+allow empty section - 160531
-		sect = "";
+	IniString str;
+	try {
+		Serialize(str);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory : %s\n", __FUNCTION__, iniFileName);
+		return false;
 	}
-	if (!key||!val) {
-		return 1;
+	char crc32str[crc32StrSize + 1] = { 0 };
+	if (!Ini::WriteFile(iniFileName, str.c_str(), str.size(), writeCRC, crc32str)) {
+		return false;
 	}
+	contentsChanged = false;
+	return true;
+}
 
-	if (sortedFile) {
-		if (lastParsedSection==sects.end() || StringNoCaseCompare(lastParsedSection->key, sect, maxSectKeyLen)) {
-			LOGD("Create section : '%s'\n", sect);
-
-			Section newSect;
-			Item newItem;
-			newSect.items.push_back(newItem);
-			sects.push_back(newSect);
-
-			sects.back().key = PushString(sect);
-			sects.back().keyLen = strlen(sect);
-			
-			lastParsedSection = --sects.end();			
-
-			return CreateItem(sects.back().items.back(), key, val);
-		} else {
-			Item newItem;
-			lastParsedSection->items.push_back(newItem);
-
-			return CreateItem(lastParsedSection->items.back(), key, val);
+//Same format as the Ini::ToString.
+template<typename String>
+void
+CompactIni::Serialize(String& str) const
+{
+	str.reserve(pool.size() + items.size() * (1 + EOL_LEN) + sects.size() * (3 + EOL_LEN));
+	for (size_t s = 0; s < sects.size(); s++) {
+		const Section& sect = sects[s];
+		bool finalSect = s + 1 == sects.size();
+		if (sect.keyLen) {
+			str.push_back('[');
+			str.append(&pool[sect.key], sect.keyLen);
+			str.append("]" EOL, 1 + EOL_LEN);
 		}
-	}
-
-	SectionList::iterator foundSect = lower_bound(sects.begin(), sects.end(), sect, Section::Compare);
-
-	if (foundSect==sects.end()) {
-		LOGD("Create section : '%s'\n", sect);
-
-		Section newSect;
-		Item newItem;
-		newSect.items.push_back(newItem);
-		sects.push_back(newSect);
-
-		sects.back().key = PushString(sect);
-		sects.back().keyLen = strlen(sect);
-		
-		return CreateItem(sects.back().items.back(),key,val);
-	} else {
-		if (StringNoCaseCompare(foundSect->key, sect, maxSectKeyLen)) {
-			LOGD("Insert section : '%s'\n", sect);
-
-			Section newSect;
-			Item newItem;
-			newSect.items.push_back(newItem);
-			SectionList::iterator insSect = sects.insert(foundSect, newSect);
-
-			insSect->key = PushString(sect);
-			insSect->keyLen = strlen(sect);			
-			
-			return CreateItem(insSect->items.back(),key,val);
-		} else {
-			LOGD("Update section : '%s'\n",foundSect->key);
-
-			ItemList::iterator foundItem = lower_bound(foundSect->items.begin(), foundSect->items.end(), key, Item::Compare);
-
-			if (foundItem==foundSect->items.end()) {
-				Item newItem;
-				foundSect->items.push_back(newItem);
-
-				return CreateItem(foundSect->items.back(),key,val);
-			} else {
-				if (StringNoCaseCompare(foundItem->key, key, maxSectKeyLen)) {
-					Item newItem;
-					ItemList::iterator newItemPos = foundSect->items.insert(foundItem, newItem);
-
-					return CreateItem(*newItemPos,key,val);
-				} else {
-					size_t valLen = strlen(val);
-					if (strncmp(foundItem->val, val, max(strlen(foundItem->val), valLen))) {
-						contentsChanged = true;
-						LOGD("Update item : '%s'='%s'\n", key, val);
-
-						if (valLen + 1 <= foundItem->valRoom) {
-							memcpy((void*)foundItem->val, val, valLen + 1);
-							foundItem->valLen = valLen;
-						} else {
-							foundItem->val = PushString(val);
-							foundItem->valLen = valLen;
-							foundItem->valRoom = valLen + 1;
-						}
-						return 0;
-					} else {
-						LOGD("Unchanged item : '%s'='%s'\n", key, val);
-						return 0;
-					}
-				}
+		for (unsigned int i = sect.first; i < sect.first + sect.count; i++) {
+			str.append(&pool[items[i].key], items[i].keyLen);
+			str.push_back('=');
+			str.append(&pool[items[i].val], items[i].valLen);
+			if (!finalSect || i + 1 < sect.first + sect.count) {
+				str.append(EOL, EOL_LEN);
 			}
 		}
+		if (!finalSect) {
+			str.append(EOL, EOL_LEN);
+		}
 	}
 }
 
-/*
-void
-Ini::SetValueStrMulti(const char* sect, const char* key, const char* val)
+string
+CompactIni::ToString() const
 {
-	//TBD
+	string str;
+	Serialize(str);
+	return str;
 }
-*/
 
-void
-Ini::SetValueInt(const char* sect, const char* key, int val)
+CompactIni::SectionList::const_iterator
+CompactIni::LowerSection(const char* sect) const
 {
-	//32bit machine: -2147483648 ~ 2147483647
-	//TBD: fit max int width in the 64bit machine?	
-	char buf[100];
-#if defined (WIN32) && !defined(__CYGWIN__)
-	itoa(val, buf, 10);
-#else
-	snprintf(buf,sizeof(buf),"%d",val);
-#endif
-	SetValueStr(sect,key,buf);
+	const char* p = pool.data();
+	return lower_bound(sects.begin(), sects.end(), sect, [p](const Section& s, const char* key) {
+		return StringNoCaseCompare(p + s.key, key, Ini::maxSectKeyLen) < 0;
+	});
 }
 
-void
-Ini::SetValueUInt(const char* sect, const char* key, unsigned int val)
+const CompactIni::Section*
+CompactIni::FindSection(const char* sect) const
 {
-	//TBD: fit max unsigned int width in the 64bit machine?	
-	char buf[100];
-#ifdef ultoa
-	ultoa(val,buf,10);
-#else	
-	snprintf(buf,sizeof(buf),"%u",val);
-#endif
-	SetValueStr(sect,key,buf);
+	if (!sect) {
+		sect = "";
+	}
+	SectionList::const_iterator found = LowerSection(sect);
+	if (found == sects.end() || StringNoCaseCompare(&pool[found->key], sect, Ini::maxSectKeyLen)) {
+		return NULL;
+	}
+	return &*found;
 }
 
-void
-Ini::SetValueLong(const char* sect, const char* key, long val)
+const CompactIni::Item*
+CompactIni::FindItem(const char* sect, const char* key) const
 {
-	//long l = -2147483648;//mingw32-gcc: ../ini.cpp:1581:2: error: this decimal constant is unsigned only in ISO C90 [-Werror]	
-	//TBD: fit buffer size to max value width
-	char buf[100];
-#if defined (WIN32)
-	ltoa(val, buf, 10);
-#else
-	snprintf(buf,sizeof(buf),"%ld",val);
-#endif
-	SetValueStr(sect,key,buf);
+	const Section* s = key ? FindSection(sect) : NULL;
+	if (!s) {
+		return NULL;
+	}
+	const char* p = pool.data();
+	ItemList::const_iterator b = items.begin() + s->first;
+	ItemList::const_iterator e = b + s->count;
+	ItemList::const_iterator found = lower_bound(b, e, key, [p](const Item& i, const char* key) {
+		return StringNoCaseCompare(p + i.key, key, Ini::maxSectKeyLen) < 0;
+	});
+	if (found == e || StringNoCaseCompare(p + found->key, key, Ini::maxSectKeyLen)) {
+		return NULL;
+	}
+	return &*found;
 }
 
-void
-Ini::SetValueULong(const char* sect, const char* key, unsigned long val)
+int
+CompactIni::GetSectItemCount(const char* sect) const
 {
-	//32bit machine: 4,294,967,295
-	char buf[100];
-#ifdef ultoa
-	ultoa(val, buf, 10);
-#else
-	snprintf(buf,sizeof(buf),"%lu",val);
-#endif
-	SetValueStr(sect,key,buf);
+	const Section* s = FindSection(sect);
+	return s ? s->count : 0;
 }
 
-void
-Ini::SetValueLongLong(const char* sect, const char* key, long long val)
+const char*
+CompactIni::GetValueStr(const char* sect, const char* key, const char* _default) const
 {
-	//language spec: –9,223,372,036,854,775,808 to 9,223,372,036,854,775,807
-	//but actually...
-	//long long ll = -9223372036854775808; //mingw32-gcc: ../ini.cpp:1610:18: error: integer constant is so large that it is unsigned [-Werror]
-	//TBD: fit buffer size to max value width
-	char buf[sizeof("-9223372036854775808")];
-#if (defined (WIN32) && !defined(__MINGW32__)) || defined(__CYGWIN__)
-	snprintf(buf, sizeof(buf), "%lld", val);
-#else
-	lltoa(val, buf, 10);
-#endif
-	SetValueStr(sect,key,buf);
+	const Item* item = FindItem(sect, key);
+	return item ? &pool[item->val] : _default;
 }
 
-void
-Ini::SetValueULongLong(const char* sect, const char* key, unsigned long long val)
+int
+CompactIni::GetValueInt(const char* sect, const char* key, int _default) const
 {
-	//language spec: 0 to 18,446,744,073,709,551,615
-	//but actually it is up to 1844674407370955169
-	//unsigned long long ull = 18446744073709551615;//mingw32-gcc: ../ini.cpp:1617:27: error: integer constant is so large that it is unsigned [-Werror]	
-	//TBD: fit buffer size to max value width
-	char buf[sizeof("18446744073709551615")];
-#if (defined (WIN32) && !defined(__MINGW32__)) || defined(__CYGWIN__)
-	snprintf(buf, sizeof(buf), "%llu", val);
-#else
-	ulltoa(val, buf, 10);
-#endif
-	SetValueStr(sect,key,buf);
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return atoi(val);
 }
 
-void
-Ini::SetValueFloat(const char* sect, const char* key, float val)
+long
+CompactIni::GetValueLong(const char* sect, const char* key, long _default) const
 {
-	char buf[100];
-	//TBD: input x to 0.xf
-	snprintf(buf,100,"%0.7f",val);
-	SetValueStr(sect,key,buf);
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return strtol(val, NULL, 10);
+}
+
+double
+CompactIni::GetValueDouble(const char* sect, const char* key, double _default) const
+{
+	const char* val = GetValueStr(sect, key, NULL);
+	if (val == NULL || *val == 0) {
+		return _default;
+	}
+	return strtod(val, NULL);
+}
+
+//A new item shifts the later items by one, and a longer value is appended to the pool.
+int
+CompactIni::SetValueStr(const char* sect, const char* key, const char* val)
+{
+	if (!sect) {
+		sect = "";
+	}
+	if (!key || !val) {
+		return 1;
+	}
+	//Copy the strings from the own pool before it grows.
+	IniString copies[3];
+	const char** strs[3] = { &sect, &key, &val };
+	for (int i = 0; i < 3; i++) {
+		if (pool.data() <= *strs[i] && *strs[i] < pool.data() + pool.size()) {
+			try {
+				copies[i] = *strs[i];
+			} catch (const std::bad_alloc&) {
+				LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+				return 1;
+			}
+			*strs[i] = copies[i].c_str();
+		}
+	}
+
+	//The strings pushed for a new item are dropped again if it fails, so no empty section is left.
+	size_t mark = pool.size();
+	size_t valLen = strlen(val);
+	SectionList::iterator s = sects.begin() + (LowerSection(sect) - sects.begin());
+	if (s == sects.end() || StringNoCaseCompare(&pool[s->key], sect, Ini::maxSectKeyLen)) {
+		Section newSect;
+		Item newItem;
+		newSect.keyLen = (unsigned int)strlen(sect);
+		newItem.keyLen = (unsigned int)strlen(key);
+		newItem.valLen = (unsigned int)valLen;
+		if (!PushString(sect, newSect.keyLen, newSect.key) || !PushString(key, newItem.keyLen, newItem.key)
+			|| !PushString(val, valLen, newItem.val)) {
+			pool.resize(mark);
+			return 1;
+		}
+		newSect.first = (unsigned int)(s == sects.end() ? items.size() : s->first);
+		newSect.count = 1;
+		try {
+			items.insert(items.begin() + newSect.first, newItem);
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+			pool.resize(mark);
+			return 1;
+		}
+		try {
+			s = sects.insert(s, newSect);
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+			items.erase(items.begin() + newSect.first);
+			pool.resize(mark);
+			return 1;
+		}
+		for (s++; s != sects.end(); s++) {
+			s->first++;
+		}
+		contentsChanged = true;
+		return 0;
+	}
+
+	const char* p = pool.data();
+	ItemList::iterator b = items.begin() + s->first;
+	ItemList::iterator e = b + s->count;
+	ItemList::iterator found = lower_bound(b, e, key, [p](const Item& i, const char* key) {
+		return StringNoCaseCompare(p + i.key, key, Ini::maxSectKeyLen) < 0;
+	});
+	if (found != e && 0 == StringNoCaseCompare(p + found->key, key, Ini::maxSectKeyLen)) {
+		if (found->valLen == valLen && 0 == memcmp(p + found->val, val, valLen)) {
+			return 0;
+		}
+		if (valLen <= found->valLen) {
+			memcpy(&pool[found->val], val, valLen + 1);
+			garbage += found->valLen - valLen;
+		} else {
+			unsigned int offset;
+			if (!PushString(val, valLen, offset)) {
+				return 1;
+			}
+			garbage += found->valLen + 1;
+			found->val = offset;
+		}
+		found->valLen = (unsigned int)valLen;
+		contentsChanged = true;
+		return 0;
+	}
+
+	Item newItem;
+	newItem.keyLen = (unsigned int)strlen(key);
+	newItem.valLen = (unsigned int)valLen;
+	if (!PushString(key, newItem.keyLen, newItem.key) || !PushString(val, valLen, newItem.val)) {
+		pool.resize(mark);
+		return 1;
+	}
+	try {
+		items.insert(found, newItem);
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory : [%s] %s\n", __FUNCTION__, sect, key);
+		pool.resize(mark);
+		return 1;
+	}
+	s->count++;
+	for (s++; s != sects.end(); s++) {
+		s->first++;
+	}
+	contentsChanged = true;
+	return 0;
 }
 
 void
-Ini::SetValueDouble(const char* sect, const char* key, double val)
+CompactIni::SetValueInt(const char* sect, const char* key, int val)
 {
 	char buf[100];
-	//TBD: input x to 0.xf
-	snprintf(buf,100,"%0.7f",val);
-	SetValueStr(sect,key,buf);
+	snprintf(buf, sizeof(buf), "%d", val);
+	SetValueStr(sect, key, buf);
 }
 
 void
-Ini::Dump(void)
+CompactIni::ShrinkToFit()
 {
-	LOGN("%s:\n", __func__);
-	for (SectionList::iterator sect=sects.begin(); sect!=sects.end(); sect++) {
-		LOGN("[%s]\n",sect->key);
-		for (ItemList::iterator item=sect->items.begin(); item!=sect->items.end(); item++) {
-			LOGN("%s=%s\n",item->key,item->val);
+	if (garbage) {
+		decltype(pool) packed;
+		try {
+			packed.reserve(pool.size() - garbage);
+		} catch (const std::bad_alloc&) {
+			LOGE("%s : out of memory, the replaced values are kept\n", __FUNCTION__);
+			return;
+		}
+		//Nothing allocates any more, all is reserved.
+		packed.push_back(0);
+		for (size_t s = 0; s < sects.size(); s++) {
+			unsigned int offset = (unsigned int)packed.size();
+			packed.insert(packed.end(), &pool[sects[s].key], &pool[sects[s].key] + sects[s].keyLen + 1);
+			sects[s].key = offset;
 		}
+		for (size_t i = 0; i < items.size(); i++) {
+			unsigned int offset = (unsigned int)packed.size();
+			packed.insert(packed.end(), &pool[items[i].key], &pool[items[i].key] + items[i].keyLen + 1);
+			items[i].key = offset;
+			offset = (unsigned int)packed.size();
+			packed.insert(packed.end(), &pool[items[i].val], &pool[items[i].val] + items[i].valLen + 1);
+			items[i].val = offset;
+		}
+		pool.swap(packed);
+		garbage = 0;
+	}
+	try {
+		pool.shrink_to_fit();
+		sects.shrink_to_fit();
+		items.shrink_to_fit();
+	} catch (const std::bad_alloc&) {
+		LOGE("%s : out of memory, the spare room is kept\n", __FUNCTION__);
 	}
 }
 
-//------------->8------------->8------------->8------------->8------------->8------------->8
\ No newline at end of file
+size_t
+CompactIni::GetMemoryUsage() const
+{
+	return sizeof(*this) + pool.capacity() + sects.capacity() * sizeof(Section) + items.capacity() * sizeof(Item);
+}
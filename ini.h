@@ -81,7 +81,6 @@
  TBD.
  * Hash sections and keys and reuse it if new one is already in the string pool.
  * Lightweight mode : Don't allocate the memory for all contents, just index the ini file contents and search it. 
- * Set debug function of the caller.
  * Employ TDD.
  * Partially read, partially update the value, but concerning lower speed. 
 */
@@ -89,20 +88,44 @@
 
 #include <stdio.h>
 #include <string.h>//for gpp - 140103
+#include <time.h>
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <functional>
+#if defined(WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 #define LOG_PREFIX "%s[INI]"
 
-#define LOGD(fmt,...) Ini::Dprintf(Ini::Debug, LOG_PREFIX fmt, Ini::GetTimeStamp(), ##__VA_ARGS__)
-#define LOGV(fmt,...) Ini::Dprintf(Ini::Verbose, LOG_PREFIX fmt, Ini::GetTimeStamp(), ##__VA_ARGS__)
-#define LOGN(fmt,...) Ini::Dprintf(Ini::Normal, LOG_PREFIX fmt, Ini::GetTimeStamp(), ##__VA_ARGS__)
-#define LOGE(fmt,...) Ini::Dprintf(Ini::Error, LOG_PREFIX fmt, Ini::GetTimeStamp(), ##__VA_ARGS__)
-
+//Lowest level compiled in, 0:Debug 1:Verbose 2:Normal 3:Error. Define it to strip the lower levels.
+#ifndef LOG_LEVEL_MIN
 #ifdef NDEBUG
-#undef LOGD
-#define LOGD(fmt,...) ((void)0)
+#define LOG_LEVEL_MIN 1
+#else
+#define LOG_LEVEL_MIN 0
 #endif
+#endif
+
+//The level is checked before the time stamp and the arguments are evaluated.
+//Levels under the LOG_LEVEL_MIN are constant false, so the compiler drops them entirely.
+#define LOG_AT(level,fmt,...) do { \
+		if ((level) >= LOG_LEVEL_MIN && (level) >= Ini::GetLogLevel()) { \
+			Ini::Dprintf(level, LOG_PREFIX fmt, Ini::GetTimeStamp(), ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+#define LOGD(fmt,...) LOG_AT(Ini::Debug, fmt, ##__VA_ARGS__)
+#define LOGV(fmt,...) LOG_AT(Ini::Verbose, fmt, ##__VA_ARGS__)
+#define LOGN(fmt,...) LOG_AT(Ini::Normal, fmt, ##__VA_ARGS__)
+#define LOGE(fmt,...) LOG_AT(Ini::Error, fmt, ##__VA_ARGS__)
+
 
 inline int StringNoCaseCompare(const char* sz1, const char* sz2, int maxlen) {
 #if !defined(NDEBUG)
@@ -119,12 +142,117 @@ inline int StringNoCaseCompare(const char* sz1, const char* sz2, int maxlen) {
 #endif	
 } 
 
+//Reader/writer lock for the ConcurrentIni.
+class RWLock
+{
+#if defined(WIN32)
+	SRWLOCK lock;
+#else
+	pthread_rwlock_t lock;
+#endif
+	RWLock(const RWLock&);
+	RWLock& operator=(const RWLock&);
+public:
+	RWLock();
+	~RWLock();
+	void LockShared();
+	void UnlockShared();
+	void Lock();
+	void Unlock();
+
+	struct SharedGuard {
+		RWLock& l;
+		SharedGuard(RWLock& l) : l(l) { l.LockShared(); }
+		~SharedGuard() { l.UnlockShared(); }
+	};
+	struct Guard {
+		RWLock& l;
+		Guard(RWLock& l) : l(l) { l.Lock(); }
+		~Guard() { l.Unlock(); }
+	};
+};
+
+//Allocation policy of the Ini, set by the Ini::SetAllocator once at the init before any Ini is made.
+//The string pool, the section and item lists, the file buffers and the returned buffers go through it.
+//Snapshots, subscriptions, threads and the async I/O still use the heap.
+struct IniAllocator
+{
+	void* (*alloc)(size_t size, void* context);
+	void* (*realloc)(void* ptr, size_t size, void* context);
+	void (*free)(void* ptr, void* context);
+	void* context;
+};
+
+void* IniAlloc(size_t size);
+void* IniRealloc(void* ptr, size_t size);
+void IniFree(void* ptr);
+
+//std::vector allocator over the IniAlloc. Throws std::bad_alloc when the policy is out of memory,
+//which the SetValueStr, and so the loading, catches and returns as a failure.
+template<typename T>
+struct IniStlAllocator
+{
+	typedef T value_type;
+	IniStlAllocator() {}
+	template<typename U> IniStlAllocator(const IniStlAllocator<U>&) {}
+	T* allocate(size_t n) {
+		void* p = IniAlloc(n * sizeof(T));
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t) {IniFree(p);}
+	template<typename U> struct rebind {typedef IniStlAllocator<U> other;};
+	template<typename U> bool operator==(const IniStlAllocator<U>&) const {return true;}
+	template<typename U> bool operator!=(const IniStlAllocator<U>&) const {return false;}
+};
+
+typedef std::basic_string<char, std::char_traits<char>, IniStlAllocator<char> > IniString;
+
+//Fixed arena given by the caller, for the builds allowed no malloc after the init.
+//Blocks are rounded up to the powers of two and handed out from the front in a constant time.
+//Freed blocks go to the free list of their size and are handed out again, so the reloads run flat.
+//The last block grows in place. Thread safe, the ConcurrentIni writers and the IniLoader workers
+//allocate at the same time.
+class IniArena
+{
+protected:
+	static const int sizeClasses = 48;
+	char* buf;
+	size_t size;
+	size_t top;
+	size_t last; //offset of the last block
+	size_t used; //bytes of the blocks not freed
+	size_t peak;
+	char* freeBlocks[sizeClasses]; //freed blocks of 16 << class bytes
+	mutable RWLock lock;
+	IniArena(const IniArena&);
+	IniArena& operator=(const IniArena&);
+	void* AllocLocked(size_t size);
+	void FreeLocked(void* ptr);
+	static void* Alloc(size_t size, void* arena);
+	static void* Realloc(void* ptr, size_t size, void* arena);
+	static void Free(void* ptr, void* arena);
+public:
+	IniArena(void* buf, size_t size);
+	IniAllocator GetAllocator();
+	void Reset();
+	size_t GetSize() const {return size;}
+	size_t GetUsed() const;
+	size_t GetPeak() const;
+};
+
+class IniSnapshot;
+typedef std::shared_ptr<const IniSnapshot> IniSnapshotPtr;
+class IniPatch;
+
 class Ini
 {
 public:
 	//Don't looks good, but seems no better way out.
 	static const int maxSectKeyLen = 256;
-protected:
+	//Public for the read only range views, don't modify through them.
 	struct Item
 	{
 		const char* key;
@@ -152,16 +280,16 @@ protected:
 		} Compare;
 	};
 
-	typedef std::vector<Item> ItemList;
+	typedef std::vector<Item, IniStlAllocator<Item> > ItemList;
 
 	struct Section
 	{
 		const char* key;
 		size_t keyLen;
 		ItemList items;
+		bool dirty; //changed since the last Publish
 
-		Section() : key(NULL), keyLen(0) {
-			items.reserve(100);
+		Section() : key(NULL), keyLen(0), dirty(true) {
 		}
 		
 		static struct CompareSection {
@@ -180,10 +308,46 @@ protected:
 		} Compare;
 	};
 
-	typedef std::vector<Section> SectionList;	
+	typedef std::vector<Section, IniStlAllocator<Section> > SectionList;	
+
+	//Read only view over the contiguous run of a sorted vector, usable in range-for.
+	//Holds no cursor in the Ini, so any number of ranges can be walked at once.
+	//Invalidated by adding a section or a key, like the vector iterators.
+	template<typename T>
+	class Range
+	{
+	public:
+		typedef typename std::vector<T, IniStlAllocator<T> >::const_iterator const_iterator;
+		typedef const_iterator iterator;
+	protected:
+		const_iterator b;
+		const_iterator e;
+	public:
+		Range() : b(), e() {}
+		Range(const_iterator b, const_iterator e) : b(b), e(e) {}
+		const_iterator begin() const {return b;}
+		const_iterator end() const {return e;}
+		size_t size() const {return e - b;}
+		bool empty() const {return b == e;}
+		const T& operator[](size_t i) const {return b[i];}
+	};
+	typedef Range<Item> ItemRange;
+	typedef Range<Section> SectionRange;
+	//Value filled by the GetSectValues, val is NULL if the key is not found.
+	struct ValueSpan
+	{
+		const char* val;
+		size_t len;
+	};
+	//Elements of a multi-value key, spans into the value valid until it changes.
+	typedef std::vector<ValueSpan, IniStlAllocator<ValueSpan> > ValueList;
+	typedef Range<ValueSpan> ValueRange;
 
+protected:
 	friend Item;
 	friend Section;
+	friend class IniLoader;
+	friend class CompactIni;
 
 	SectionList sects;
 	SectionList::iterator lastParsedSection;
@@ -196,23 +360,112 @@ protected:
 	size_t sizPool;
 	size_t remPool; //remaining pool size
 	unsigned int posPool;
+	bool pinPool; //never move the pool, chain new chunks when it is out of space
+	bool multiValueKeys; //join the repeated keys of a file
+	char multiValueDelim;
+	//Element index of a multi-value key, built by the GetValues and dropped by the Changed of the key.
+	struct ValueIndex
+	{
+		const char* val; //the value indexed, checked against the item
+		size_t valLen;
+		ValueList elems;
+
+		ValueIndex() : val(NULL), valLen(0) {}
+	};
+	typedef std::map<IniString, ValueIndex, std::less<IniString>, IniStlAllocator<std::pair<const IniString, ValueIndex> > > ValueIndexMap;
+	ValueIndexMap valueIndexes; //by the folded section and key
+	typedef std::vector<char*, IniStlAllocator<char*> > PoolChunkList;
+	PoolChunkList poolChunks; //previous chunks of the pinned pool and the adopted load buffers
+	const char* adoptFrom; //tokens of the buffer being parsed in place
+	const char* adoptTo;
 
 	char iniFileName[256];
+	long fileSize; //stamp of the iniFileName for the ReloadFile, -1 if unknown
+	time_t fileMTime;
+	long fileMTimeNsec;
+	char fileCRC[8 + 1];
 	static int logLevel;
 
 	bool contentsChanged;
 	bool saveChangedFileOnly;
 
+	std::atomic<const IniSnapshotPtr*> published; //swapped atomically, read under a hazard slot, see GetSnapshot
+	std::vector<const IniSnapshotPtr*> retiredSnapshots; //replaced by the Publish, maybe still read by a GetSnapshot
+	unsigned long publishedVersion;
+
+public:
+	struct Change
+	{
+		std::string sect;
+		std::string key; //empty if the wholeSection is changed or removed
+		bool wholeSection;
+	};
+	typedef void (*ChangeCallback)(Ini* ini, const Change* changes, int count, void* context);
+protected:
+	struct Subscription
+	{
+		int id;
+		std::string sect;
+		std::string key;
+		bool wholeSection;
+		bool prefix;
+		ChangeCallback callback;
+		void* context;
+
+		bool Matches(const Change& change) const;
+	};
+	struct BatchGuard
+	{
+		Ini& ini;
+		BatchGuard(Ini& ini) : ini(ini) { ini.BeginBatch(); }
+		~BatchGuard() { ini.EndBatch(); }
+	};
+	std::vector<Subscription> subscriptions;
+	std::vector<Change> pendingChanges;
+	int batchDepth;
+	int nextSubscriptionId;
+	bool dispatching;
+
 	int CreateItem(Item& newItem, const char* key, const char* val);
+	char* ReservePool(size_t room);
+	void FreePoolChunks();
 	const char* PushString(const char* s);
 	SectionList::iterator FindSection(const char* sect);
 	ItemList::iterator FindItem(const char* sect, const char*key);
+	int Changed(const char* sect, const char* key, int result);
+	void DispatchChanges();
+	void ReclaimSnapshots();
+	int AppendValue(Item& item, const char* val, size_t valLen);
+	void DropValueIndexes(const char* sect, const char* key);
+	void UpdateFileStamp(const char* crc32str);
+	void ClearFileStamp();
+	static bool WriteFile(const char* fileName, const char* buf, size_t bufLen, bool writeCRC, char* crc32str);
+	bool IsUnchangedSave(const char* fileName);
+	static char* ReadFile(const char* theFileName, size_t& fileSize);
+	int InsertValueStr(const char* sect, const char* key, const char* val, bool sortedFile);
+	bool FromBuffer(const char* buf, size_t buflen, bool sorted, char* own);
+	bool Parse(const char* buf, size_t buflen, bool sorted, unsigned int* crc, char* own=NULL);
+	bool ParseChecked(const char* theFileName, const char* buf, size_t bufLen, unsigned int expected, char* own);
+	void TakeContents(Ini& from);
+	bool LoadBuffer(const char* theFileName, char* buf, size_t bufLen, bool checkCRC, const unsigned int* bodyCRC, unsigned long long* phaseNs=NULL, bool adopt=false);
+	template<typename String> bool Serialize(size_t& sect, size_t& item, String& str, size_t limit);
+	bool LoadFileQueued(const char* theFileName, bool checkCRC);
+	bool SaveFileQueued(const char* theFileName, bool writeCRC);
+	int ApplyItems(Section& dst, const Section& src);
+	int ApplyFrom(const Ini& src);
+	int ApplyPatchItems(Section& sect, const IniPatch& patch, size_t first, size_t last);
 public:
 	// Life Cycle
 	Ini(const int strPoolSize=64*1024);
 	virtual ~Ini(void);
 	bool LoadFile(const char* iniFileName, bool checkCRC=true);
 	bool SaveFile(const char* iniFileName=NULL, bool writeCRC=true);
+	//Load and save on the I/O threads, by io_uring on Linux, and report to the done from the I/O thread.
+	//Don't touch the Ini until the done is called.
+	typedef void (*CompletionFunc)(Ini* ini, bool result, void* context);
+	bool LoadFileAsync(const char* iniFileName, CompletionFunc done, void* context=NULL, bool checkCRC=true);
+	bool SaveFileAsync(const char* iniFileName, CompletionFunc done, void* context=NULL, bool writeCRC=true);
+	int ReloadFile(bool checkCRC=true);
 	void SetFileName(const char* iniFileName);
 	const char* GetFileName();
 	bool FromString(const char* buf, size_t buflen, bool sorted=false);
@@ -220,6 +473,20 @@ public:
 	void Reset();
 	static bool ValidateFile(const char* iniFileName);
 	static bool ValidateFormat(const char* buf, size_t buflen);
+	// Diff, Merge, Patch
+	//Returns false if out of memory, the patch is left empty.
+	bool Diff(const Ini& to, IniPatch& patch, bool withRemoved=true) const;
+	int ApplyPatch(const IniPatch& patch);
+	int Merge(const Ini& other);
+	// Change Notification
+	int Subscribe(const char* sect, const char* key, ChangeCallback callback, void* context=NULL);
+	int SubscribePrefix(const char* sectPrefix, const char* keyPrefix, ChangeCallback callback, void* context=NULL);
+	void Unsubscribe(int id);
+	void BeginBatch();
+	void EndBatch();
+	// Snapshot
+	IniSnapshotPtr Publish();
+	IniSnapshotPtr GetSnapshot() const;
 	// Property
 	inline int GetSectCount() {return sects.size();}
 	int GetItemCount();
@@ -232,6 +499,21 @@ public:
 	int FindNextKey(const char** key, const char** val);
 	const char* FindFirstSection();
 	const char* FindNextSection();
+	SectionRange Sections() const;
+	ItemRange Items(const char* sect) const;
+	static ItemRange Items(const Section& sect) {return ItemRange(sect.items.begin(), sect.items.end());}
+	//Sections or keys from the first up to but not including the last, NULL for no bound, or starting with the prefix.
+	//In the StringNoCaseCompare order, so the prefix is matched case insensitive.
+	SectionRange Sections(const char* first, const char* last) const;
+	SectionRange SectionsWithPrefix(const char* prefix) const;
+	ItemRange Items(const char* sect, const char* first, const char* last) const;
+	ItemRange ItemsWithPrefix(const char* sect, const char* prefix) const;
+	// Raw value encoding, 00 AB CD by default. HexCompact and Base64 cut the stored size by 1/3 and 5/9.
+	enum RawEncoding {
+		HexSpaced = 0,
+		HexCompact = 1,
+		Base64 = 2,
+	};
 	// Get Functions
 	inline char GetValue(const char* sect, const char* key, char& val, char _default=0) {return(val = (char)GetValueInt(sect,key,_default));}
 	inline unsigned char GetValue(const char* sect, const char* key, unsigned char& val, unsigned char _default=0) {return(val = (unsigned char)GetValueInt(sect,key,_default));}
@@ -254,7 +536,21 @@ public:
 	float GetValueFloat(const char* sect, const char* key, float _default=0.0);
 	double GetValueDouble(const char* sect, const char* key, double _default=0.0);
 	inline long double GetValueLongDouble(const char* sect, const char* key, long double _default=0.0) {return GetValueDouble(sect,key,_default);}
-	void GetValueRaw(const char* sect, const char* key, void* byteArray, const size_t byteArraySize, unsigned char _default=0x00);
+	//values[i] is set for keys[i], NULL keys are not found. Set keysSorted if the keys are in the StringNoCaseCompare order already.
+	//Returns the number of the keys found, or -1 if out of memory.
+	int GetSectValues(const char* sect, const char* const* keys, size_t count, ValueSpan* values, bool keysSorted=false);
+	//Multi-value keys hold the elements joined by the delim, like 'key=1, 2, 3'.
+	//Repeated keys of a file are joined into the list if enabled, instead of the last one overwriting the others.
+	void SetMultiValueKeys(bool enable, char delim=',') {multiValueKeys = enable; multiValueDelim = delim;}
+	//Spans of the elements, the blanks around them are trimmed. The value is split on the first call and
+	//the index is kept until the value changes, which invalidates the range. Empty if the key is not found.
+	ValueRange GetValues(const char* sect, const char* key);
+	//Converts the indexed elements into the values, up to the count.
+	//Returns the number of the elements converted, stops at the first one which is not a number.
+	size_t GetValuesInt(const char* sect, const char* key, int* values, size_t count);
+	size_t GetValuesLong(const char* sect, const char* key, long* values, size_t count);
+	size_t GetValuesDouble(const char* sect, const char* key, double* values, size_t count);
+	void GetValueRaw(const char* sect, const char* key, void* byteArray, const size_t byteArraySize, unsigned char _default=0x00, RawEncoding encoding=HexSpaced);
 	#define GetValueBuf(sect,key,buf) GetValueRaw(sect,key,&buf,sizeof(buf))
 	// Set Functions
 	inline void SetValue(const char* sect, const char* key, char val) {SetValueInt(sect, key, val);}
@@ -275,7 +571,8 @@ public:
 	inline void SetValue(const char* sect, const char* key, long double val) {SetValueLongDouble(sect, key, val);}
 	int SetValueStr(const char* sect, const char* key, const char* val, bool sortedFile = false);
 	void SetValueStrBuf(const char* sect, const char* key, char* buf, size_t bufSize);
-	//TBD: void SetValueStrMulti(const char* sect, const char* key, const char* val);
+	//Appends the val as an element of the multi-value key, growing the value in place.
+	int SetValueStrMulti(const char* sect, const char* key, const char* val);
 	void SetValueInt(const char* sect, const char* key, int val);
 	void SetValueUInt(const char* sect, const char* key, unsigned int val);
 	void SetValueLong(const char* sect, const char* key, long val);
@@ -285,11 +582,14 @@ public:
 	void SetValueFloat(const char* sect, const char* key, float val);
 	void SetValueDouble(const char* sect, const char* key, double val);
 	inline void SetValueLongDouble(const char* sect, const char* key, long double val) {SetValueDouble(sect,key,val);}
-	void SetValueRaw(const char* sect, const char* key, const void* buf, const size_t bufLen);
+	void SetValueRaw(const char* sect, const char* key, const void* buf, const size_t bufLen, RawEncoding encoding=HexSpaced);
 	#define SetValueBuf(sect,key,buf) SetValueRaw(sect,key,&buf,sizeof(buf))	
-	//Helper func.
+	//Helper func. Free the returned string by the free, it stays on the malloc for the existing callers.
 	static char* ByteArrayToHexString(const unsigned char* byteArray, size_t sizeArray);
 	static int HexStringToByteArray(const char* hexString, unsigned char* byteArray, size_t sizeByteArray);
+	static size_t GetRawEncodedLength(size_t sizeByteArray, RawEncoding encoding);
+	static size_t EncodeRaw(const unsigned char* byteArray, size_t sizeByteArray, char* s, RawEncoding encoding);
+	static size_t DecodeRaw(const char* s, size_t len, unsigned char* byteArray, size_t sizeByteArray, RawEncoding encoding);
 	void Dump(void);
 	enum LogLevel {
 		Debug = 0,
@@ -298,7 +598,347 @@ public:
 		Error = 3,
 	};
 	static void SetLogLevel(int level) {logLevel = level;}
+	//NULL sets back the malloc.
+	static void SetAllocator(const IniAllocator* allocator);
 	static int GetLogLevel() {return logLevel;}
+	typedef void (*LogFunc)(int level, const char* msg, void* context);
+	static void SetLogFunc(LogFunc func, void* context=NULL);
+	static bool StartAsyncLog(size_t capacity=1024);
+	static void StopAsyncLog();
+	//Runtime statistics, off until EnableStats. Each thread counts on its own, GetStats sums them up.
+	enum StatCounter {
+		StatLookupHit,
+		StatLookupMiss,
+		StatPoolGrow,
+		StatPoolBytesMoved,
+		StatFileFlush,
+		StatFileSync,
+		StatBytesRead,
+		StatBytesWritten,
+		StatParseSort, //loads of the sorted files found out of order
+		StatCounterCount
+	};
+	enum StatTimer {
+		StatLookupTime,
+		StatLoadReadTime,
+		StatLoadCRCTime,
+		StatLoadParseTime,
+		StatSaveTime,
+		StatTimerCount
+	};
+	static const int statBucketCount = 40;
+	struct Stats {
+		unsigned long long counters[StatCounterCount];
+		struct Histogram {
+			unsigned long long count;
+			unsigned long long totalNs;
+			unsigned long long buckets[statBucketCount];//bucket n counts the times shorter than 2^n ns
+		} timers[StatTimerCount];
+		unsigned long long GetPercentileNs(StatTimer timer, double percentile) const;
+	};
+	static void EnableStats(bool enable);
+	static bool IsStatsEnabled();
+	static void GetStats(Stats& stats);
+	static std::string DumpStats();
+	static void ResetStats();
 	static void Dprintf(int level, const char* fmt, ...);
 	static const char* GetTimeStamp();
-};
\ No newline at end of file
+};
+
+//Immutable version of the Ini published by Ini::Publish.
+//Unchanged sections are shared between the versions, and freed with the last snapshot holding them.
+//Strings are valid while the snapshot is alive.
+class IniSnapshot
+{
+public:
+	struct Item
+	{
+		const char* key;
+		size_t keyLen;
+		const char* val;
+		size_t valLen;
+	};
+	struct Section
+	{
+		const char* key;
+		size_t keyLen;
+		std::vector<Item> items;
+		std::vector<char> pool; //sized once, never reallocated
+	};
+	typedef std::shared_ptr<const Section> SectionPtr;
+	typedef std::vector<SectionPtr> SectionList;
+protected:
+	friend class Ini;
+	SectionList sects;
+	unsigned long version;
+public:
+	IniSnapshot() : version(0) {}
+	unsigned long GetVersion() const {return version;}
+	int GetSectCount() const {return sects.size();}
+	int GetItemCount() const;
+	int GetSectItemCount(const char* sect) const;
+	const Section* FindSection(const char* sect) const;
+	const Item* FindItem(const char* sect, const char* key) const;
+	bool IsSection(const char* sect) const {return FindSection(sect) != NULL;}
+	bool IsKey(const char* sect, const char* key) const {return FindItem(sect, key) != NULL;}
+	const char* GetValueStr(const char* sect, const char* key, const char* _default="") const;
+	int GetValueInt(const char* sect, const char* key, int _default=0) const;
+	long GetValueLong(const char* sect, const char* key, long _default=0) const;
+	double GetValueDouble(const char* sect, const char* key, double _default=0.0) const;
+};
+
+//Differences between two Ini made by the Ini::Diff, sorted by the section and the key.
+//Serialized like an INI file with the operation in front of each key:
+// [sect]
+// +added=val
+// ~modified=val
+// -removed
+class IniPatch
+{
+public:
+	enum Op {
+		Added = '+',
+		Removed = '-',
+		Modified = '~',
+	};
+	struct Entry
+	{
+		char op;
+		size_t sect; //offsets to the strings
+		size_t sectLen;
+		size_t key;
+		size_t keyLen;
+		size_t val;
+		size_t valLen;
+	};
+	typedef std::vector<Entry, IniStlAllocator<Entry> > EntryList;
+protected:
+	friend class Ini;
+	EntryList entries;
+	IniString strings; //null terminated sect, key and value of the entries
+	bool Add(char op, const char* sect, size_t sectLen, const char* key, size_t keyLen, const char* val, size_t valLen);
+public:
+	void Clear() {entries.clear(); strings.clear();}
+	bool IsEmpty() const {return entries.empty();}
+	int GetCount() const {return entries.size();}
+	int GetCount(Op op) const;
+	char GetOp(int i) const {return entries[i].op;}
+	const char* GetSect(int i) const {return strings.c_str() + entries[i].sect;}
+	const char* GetKey(int i) const {return strings.c_str() + entries[i].key;}
+	const char* GetVal(int i) const {return strings.c_str() + entries[i].val;}
+	std::string ToString() const;
+	bool FromString(const char* buf, size_t buflen);
+};
+
+//Watches the file behind the Ini::GetFileName and reloads the changes into the Ini.
+//Uses inotify on the directory of the file in Linux, so renamed-over files are caught as well.
+//Other platforms fall back to the stat check of the Ini::ReloadFile on each Poll.
+//No thread is created, call Poll periodically or when the GetFd is readable.
+class IniWatcher
+{
+protected:
+	Ini& ini;
+	bool checkCRC;
+	int fd;
+	int wd;
+	char baseName[256];
+public:
+	IniWatcher(Ini& ini, bool checkCRC=true);
+	virtual ~IniWatcher(void);
+	bool Start();
+	void Stop();
+	int GetFd() const {return fd;}
+	int Poll(int timeoutMs=0);
+};
+
+//Loads or validates many files at once, each into its own Ini, on the worker threads.
+class IniLoader
+{
+public:
+	struct Result
+	{
+		std::string path;
+		Ini* ini; //NULL if the load failed, deleted with the IniLoader unless released
+		std::string error; //last error logged while loading
+		double readSec;
+		double crcSec;
+		double parseSec;
+	};
+protected:
+	std::vector<Result> results;
+	double wallSec;
+	IniLoader(const IniLoader&);
+	IniLoader& operator=(const IniLoader&);
+	void LoadOne(Result& result, bool checkCRC);
+	void ValidateOne(Result& result);
+	int Run(const std::vector<std::string>& paths, int threads, const std::function<void(Result&)>& job);
+	static bool ListDir(const char* dir, const char* suffix, std::vector<std::string>& paths);
+public:
+	IniLoader();
+	virtual ~IniLoader(void);
+	//Returns the number of the failed files, 0 if all loaded. threads=0 uses all the cores.
+	int LoadFiles(const std::vector<std::string>& paths, bool checkCRC=true, int threads=0);
+	int LoadDir(const char* dir, const char* suffix=".ini", bool checkCRC=true, int threads=0);
+	//Checks the CRC of the files like the Ini::ValidateFile, no ini is kept in the results.
+	int ValidateFiles(const std::vector<std::string>& paths, int threads=0);
+	int ValidateDir(const char* dir, const char* suffix=".ini", int threads=0);
+	size_t GetCount() const {return results.size();}
+	const Result& GetResult(size_t i) const {return results[i];}
+	Ini* Release(size_t i);
+	int GetErrorCount() const;
+	//Wall time of the last load, and the read, CRC and parse times summed over the files.
+	void GetTimes(double& wallSec, double& readSec, double& crcSec, double& parseSec) const;
+	void Clear();
+};
+
+//Read only view over the layers of Ini, e.g. the defaults, the site and the device, without copying the values.
+//A key is looked up from the top layer down, and the first layer having it wins.
+//The layers are not owned and must outlive the view.
+//The sections found in the layers are cached for the next lookup of the same section,
+//so call Invalidate after adding or removing a section in a layer, like the ranges.
+class IniOverlay
+{
+public:
+	typedef Ini::Item Item;
+	typedef Ini::Section Section;
+protected:
+	std::vector<const Ini*> layers; //bottom first
+	std::string cachedSect;
+	bool cacheValid;
+	std::vector<const Section*> cachedSects; //of each layer for the cachedSect, NULL if the layer hasn't it
+	const std::vector<const Section*>& FindSections(const char* sect);
+public:
+	IniOverlay() : cacheValid(false) {}
+	void AddLayer(const Ini& ini); //on top of the previous layers
+	void Clear();
+	void Invalidate() {cacheValid = false;}
+	size_t GetLayerCount() const {return layers.size();}
+	const Ini& GetLayer(size_t i) const {return *layers[i];}
+	//layer is set to the index of the layer having the item.
+	const Item* FindItem(const char* sect, const char* key, int* layer=NULL);
+	bool IsSection(const char* sect);
+	bool IsKey(const char* sect, const char* key) {return FindItem(sect, key) != NULL;}
+	const char* GetValueStr(const char* sect, const char* key, const char* _default="");
+	int GetValueInt(const char* sect, const char* key, int _default=0);
+	long GetValueLong(const char* sect, const char* key, long _default=0);
+	double GetValueDouble(const char* sect, const char* key, double _default=0.0);
+	//Merged and sorted like a single Ini, the names and the items of the upper layer hide the same ones below.
+	void GetSections(std::vector<const char*>& sections) const;
+	void GetItems(const char* sect, std::vector<const Item*>& items);
+};
+
+//Ini in the compact storage for the embedded targets and the processes holding many small instances.
+//Strings are kept by the 32 bit offsets into one pool, 16 bytes per item, so growing the pool rebases no pointer.
+//The items of all the sections are in one vector and nothing is reserved ahead, ShrinkToFit right sizes the rest.
+//Up to 4GB of strings. The returned strings are invalidated by the next Set, like the ranges of the Ini.
+class CompactIni
+{
+public:
+	struct Item
+	{
+		unsigned int key; //offsets into the pool
+		unsigned int keyLen;
+		unsigned int val;
+		unsigned int valLen;
+	};
+	struct Section
+	{
+		unsigned int key;
+		unsigned int keyLen;
+		unsigned int first; //index of the first item
+		unsigned int count;
+	};
+	typedef std::vector<Section, IniStlAllocator<Section> > SectionList;
+	typedef std::vector<Item, IniStlAllocator<Item> > ItemList;
+protected:
+	std::vector<char, IniStlAllocator<char> > pool; //starts with the empty string at the offset 0, empty if out of memory
+	SectionList sects;
+	ItemList items; //sorted within each section, the sections in the order
+	size_t garbage; //bytes of the replaced values in the pool
+	bool contentsChanged;
+
+	template<typename String> void Serialize(String& str) const;
+	SectionList::const_iterator LowerSection(const char* sect) const;
+	const Section* FindSection(const char* sect) const;
+	const Item* FindItem(const char* sect, const char* key) const;
+	bool PushString(const char* str, size_t len, unsigned int& offset);
+public:
+	CompactIni();
+	void Reset();
+	bool Assign(const Ini& ini);
+	//Parsed by a temporary Ini, freed before the return.
+	bool LoadFile(const char* iniFileName, bool checkCRC=true);
+	bool SaveFile(const char* iniFileName, bool writeCRC=true);
+	std::string ToString() const;
+	bool IsChanged() const {return contentsChanged;}
+	int GetSectCount() const {return sects.size();}
+	int GetItemCount() const {return items.size();}
+	int GetSectItemCount(const char* sect) const;
+	bool IsSection(const char* sect) const {return FindSection(sect) != NULL;}
+	bool IsKey(const char* sect, const char* key) const {return FindItem(sect, key) != NULL;}
+	const char* GetValueStr(const char* sect, const char* key, const char* _default="") const;
+	int GetValueInt(const char* sect, const char* key, int _default=0) const;
+	long GetValueLong(const char* sect, const char* key, long _default=0) const;
+	double GetValueDouble(const char* sect, const char* key, double _default=0.0) const;
+	//Returns 0 on success like the Ini.
+	int SetValueStr(const char* sect, const char* key, const char* val);
+	void SetValueInt(const char* sect, const char* key, int val);
+	//Drops the replaced values from the pool and frees the spare capacity.
+	void ShrinkToFit();
+	size_t GetMemoryUsage() const;
+};
+
+//Thread safe Ini.
+//Readers run in parallel, writers lock only the section they update.
+//Adding a section, loading and resetting lock the whole layout of the sections.
+//Values are copied out under the lock, so no pointer into the pool is handed out.
+class WriteBehind;
+
+class ConcurrentIni : protected Ini
+{
+public:
+	static const int shardCount = 64;
+protected:
+	friend class WriteBehind;
+	RWLock layoutLock; //sects vector, held shared by every reader and writer
+	RWLock shardLocks[shardCount]; //items of the sections, sharded by the section index
+	RWLock poolLock; //tail of the pinned string pool and contentsChanged
+	RWLock saveLock;
+
+	inline RWLock& ShardOf(SectionList::iterator sect) {return shardLocks[(sect - sects.begin()) % shardCount];}
+	void LockAllShards();
+	void UnlockAllShards();
+	int SetSectValueStr(SectionList::iterator sect, const char* key, const char* val);
+	WriteBehind* writeBehind;
+	void MarkDirty();
+	bool SaveSnapshot(const char* fileName, bool writeCRC);
+public:
+	ConcurrentIni(const int strPoolSize=64*1024);
+	virtual ~ConcurrentIni(void);
+	bool LoadFile(const char* iniFileName, bool checkCRC=true);
+	bool SaveFile(const char* iniFileName=NULL, bool writeCRC=true);
+	int ReloadFile(bool checkCRC=true);
+	bool FromString(const char* buf, size_t buflen, bool sorted=false);
+	std::string ToString();
+	void Reset();
+	int GetSectCount();
+	int GetItemCount();
+	int GetSectItemCount(const char* sect);
+	bool IsSection(const char* sect);
+	bool IsKey(const char* sect, const char* key);
+	bool GetValueStrBuf(const char* sect, const char* key, char* buf, size_t bufSize, const char* _default="");
+	std::string GetValueString(const char* sect, const char* key, const char* _default="");
+	int GetValueInt(const char* sect, const char* key, int _default=0);
+	long GetValueLong(const char* sect, const char* key, long _default=0);
+	double GetValueDouble(const char* sect, const char* key, double _default=0.0);
+	int SetValueStr(const char* sect, const char* key, const char* val);
+	void SetValueInt(const char* sect, const char* key, int val);
+	void SetValueLong(const char* sect, const char* key, long val);
+	void SetValueDouble(const char* sect, const char* key, double val);
+	//Write-behind saving, the setters only count the changes and a background thread saves them.
+	//The file is written after quietMs without a change, maxDirty changes or maxDelayMs since the first unsaved change.
+	//Start and stop it while no other thread is using the ConcurrentIni.
+	bool StartWriteBehind(const char* fileName=NULL, int quietMs=500, int maxDirty=1000, int maxDelayMs=5000, bool writeCRC=true);
+	bool Flush();
+	void StopWriteBehind();
+};
@@ -12,6 +12,10 @@
 #include <time.h>
 #endif
 #include <errno.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <vector>
 #include "ini.h"
 
 //mode=0 stop
@@ -224,6 +228,29 @@ void TestFindFunctions()
 	ini.FindNextKey(&key,&val);
 }
 
+void TestRanges()
+{
+	LOGN("<<%s>>\n",__FUNCTION__);
+
+	Ini ini;
+	Ini::SetLogLevel(Ini::Normal);
+	CreateTestSet(ini,3,3);
+
+	for (Ini::SectionRange::iterator sect = ini.Sections().begin(); sect != ini.Sections().end(); sect++) {
+		Ini::ItemRange items = Ini::Items(*sect);
+		for (Ini::ItemRange::iterator item = items.begin(); item != items.end(); item++) {
+			//second walk runs inside the first one
+			Ini::ItemRange others = ini.Items("sect0");
+			LOGN("[%.*s] %.*s=%.*s, %d items in [sect0]\n", (int)sect->keyLen, sect->key,
+				(int)item->keyLen, item->key, (int)item->valLen, item->val, (int)others.size());
+		}
+	}
+	for (const Ini::Item& item : ini.Items("sect2")) {
+		LOGN("range-for %s=%s\n", item.key, item.val);
+	}
+	LOGN("missing section has %d items\n", (int)ini.Items("nothing").size());
+}
+
 void TestSetValueFunctions()
 {
 	LOGN( "<<%s>>\n",__FUNCTION__);
@@ -384,6 +411,21 @@ void TestGetTimeStampBenchmark()
 	Stopwatch(0,"GetTimeStamp");
 }
 
+void TestDisabledLogBenchmark()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini;
+	Ini::SetLogLevel(Ini::Normal);
+	CreateTestSet(ini, 10, 100);
+	//Debug logs of the lookups are dropped before the time stamp is taken.
+	Stopwatch(1, "1000000 lookups");
+	for (int i=0; i<1000000; i++) {
+		ini.GetValueStr("sect5", "key50");
+	}
+	Stopwatch(0, "1000000 lookups");
+}
+
 void TestReallocStrPool()
 {
 	LOGN("<<%s>>\n", __FUNCTION__);
@@ -405,20 +447,1112 @@ void TestSaveContentsChangedFileOnly()
 	ini.SaveFile("test-contents-changed.ini");
 }
 
+void TestRawEncoding()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini;
+	Ini::SetLogLevel(Ini::Normal);
+
+	unsigned char blob[1000];
+	for (unsigned int i=0; i<sizeof(blob); i++) {
+		blob[i] = (unsigned char)(i*7);
+	}
+	const Ini::RawEncoding encodings[] = { Ini::HexSpaced, Ini::HexCompact, Ini::Base64 };
+	const char* names[] = { "HexSpaced", "HexCompact", "Base64" };
+	for (int e=0; e<3; e++) {
+		for (size_t len=1; len<=sizeof(blob); len+=333) {
+			unsigned char out[sizeof(blob)] = { 0 };
+			ini.SetValueRaw("Raw", names[e], blob, len, encodings[e]);
+			ini.GetValueRaw("Raw", names[e], out, len, 0, encodings[e]);
+			if (memcmp(blob, out, len)) {
+				LOGE("%s : %d bytes mismatch!\n", names[e], len);
+			}
+		}
+		LOGN("%s : %d bytes stored as %d characters\n", names[e], sizeof(blob), strlen(ini.GetValueStr("Raw", names[e])));
+	}
+	ini.SaveFile("test-raw.ini");
+	ini.Reset();
+	ini.LoadFile("test-raw.ini");
+	for (int e=0; e<3; e++) {
+		unsigned char out[sizeof(blob)] = { 0 };
+		ini.GetValueRaw("Raw", names[e], out, sizeof(blob), 0, encodings[e]);
+		if (memcmp(blob, out, sizeof(blob))) {
+			LOGE("%s : mismatch after LoadFile!\n", names[e]);
+		}
+	}
+}
+
+void ConcurrentWorker(ConcurrentIni* ini, int seed, int ops, int writePercent)
+{
+	unsigned int r = seed;
+	char sect[Ini::maxSectKeyLen];
+	char key[Ini::maxSectKeyLen];
+	char val[Ini::maxSectKeyLen];
+	for (int i=0; i<ops; i++) {
+		r = r * 1103515245 + 12345;
+		snprintf(sect, sizeof(sect), "sect%u", (r >> 8) % 100);
+		snprintf(key, sizeof(key), "key%u", (r >> 4) % 1000);
+		if ((int)(r >> 16) % 100 < writePercent) {
+			snprintf(val, sizeof(val), "val%d", i);
+			ini->SetValueStr(sect, key, val);
+		} else {
+			ini->GetValueStrBuf(sect, key, val, sizeof(val));
+		}
+	}
+}
+
+void TestConcurrentBenchmarks()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	ConcurrentIni ini(2*1024*1024);
+	for (int i=0; i<100; i++) {
+		char sect[Ini::maxSectKeyLen];
+		snprintf(sect, sizeof(sect), "sect%d", i);
+		for (int j=0; j<1000; j++) {
+			char key[Ini::maxSectKeyLen];
+			snprintf(key, sizeof(key), "key%d", j);
+			ini.SetValueStr(sect, key, "val");
+		}
+	}
+
+	const int ops = 200000;
+	int maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads < 4) {
+		maxThreads = 4;
+	}
+	const int writePercents[] = { 0, 10 };
+	for (int w=0; w<2; w++) {
+		for (int n=1; n<=maxThreads; n*=2) {
+			std::vector<std::thread> threads;
+			Stopwatch(1);
+			for (int t=0; t<n; t++) {
+				threads.push_back(std::thread(ConcurrentWorker, &ini, t+1, ops, writePercents[w]));
+			}
+			for (int t=0; t<n; t++) {
+				threads[t].join();
+			}
+			double sec = Stopwatch(0);
+			LOGN("threads=%d, writes=%d%% : %.0lf ops/sec\n", n, writePercents[w], sec > 0 ? n*ops/sec : 0);
+		}
+	}
+}
+
+void SnapshotReader(const Ini* ini, int rounds, int* inconsistent)
+{
+	for (int i=0; i<rounds; i++) {
+		IniSnapshotPtr snap = ini->GetSnapshot();
+		if (!snap) {
+			continue;
+		}
+		//A batch writes the same value to every key, so a snapshot must never mix two batches.
+		const char* first = snap->GetValueStr("batch", "key0");
+		for (int k=1; k<10; k++) {
+			char key[Ini::maxSectKeyLen];
+			snprintf(key, sizeof(key), "key%d", k);
+			if (strcmp(first, snap->GetValueStr("batch", key))) {
+				(*inconsistent)++;
+				break;
+			}
+		}
+	}
+}
+
+void TestSnapshot()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini;
+	Ini::SetLogLevel(Ini::Normal);
+	CreateTestSet(ini, 100, 100);
+	for (int k=0; k<10; k++) {
+		char key[Ini::maxSectKeyLen];
+		snprintf(key, sizeof(key), "key%d", k);
+		ini.SetValue("batch", key, 0);
+	}
+	IniSnapshotPtr first = ini.Publish();
+
+	int inconsistent[2] = { 0, 0 };
+	std::thread reader0(SnapshotReader, &ini, 100000, &inconsistent[0]);
+	std::thread reader1(SnapshotReader, &ini, 100000, &inconsistent[1]);
+	for (int batch=1; batch<=1000; batch++) {
+		for (int k=0; k<10; k++) {
+			char key[Ini::maxSectKeyLen];
+			snprintf(key, sizeof(key), "key%d", k);
+			ini.SetValue("batch", key, batch);
+		}
+		ini.Publish();
+	}
+	reader0.join();
+	reader1.join();
+
+	IniSnapshotPtr last = ini.GetSnapshot();
+	LOGN("version %lu -> %lu, batch=%s, inconsistent reads=%d\n", first->GetVersion(), last->GetVersion(),
+		last->GetValueStr("batch", "key9"), inconsistent[0] + inconsistent[1]);
+	LOGN("untouched section shared : %s\n", first->FindSection("sect0") == last->FindSection("sect0") ? "yes" : "no");
+	LOGN("first snapshot still reads batch=%s\n", first->GetValueStr("batch", "key9"));
+}
+
+void TestReloadFile()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	const char* path = "test-reload.ini";
+	{
+		Ini writer;
+		CreateTestSet(writer, 10, 10);
+		writer.SaveFile(path);
+	}
+	Ini ini;
+	ini.LoadFile(path);
+	const char* kept = ini.GetValueStr("sect5", "key5");
+	IniWatcher watcher(ini);
+	watcher.Start();
+
+	LOGN("unchanged file : %d items changed\n", ini.ReloadFile());
+	{
+		Ini writer;
+		writer.LoadFile(path);
+		writer.SetValue("sect1", "key1", "changed");
+		writer.SetValue("sect1", "new", "added");
+		writer.SetValue("new", "key0", "added");
+		writer.SaveFile(path);
+	}
+	LOGN("watcher : %d items changed\n", watcher.Poll(1000));
+	LOGN("sect1.key1=%s, new.key0=%s\n", ini.GetValueStr("sect1", "key1"), ini.GetValueStr("new", "key0"));
+	LOGN("unchanged item kept its storage : %s\n", kept == ini.GetValueStr("sect5", "key5") ? "yes" : "no");
+	LOGN("watcher without change : %d\n", watcher.Poll(0));
+}
+
+void OnChange(Ini* ini, const Ini::Change* changes, int count, void* context)
+{
+	const char* name = (const char*)context;
+	LOGN("%s : %d changes in one dispatch\n", name, count);
+	for (int i=0; i<count; i++) {
+		LOGN("  [%s] %s\n", changes[i].sect.c_str(), changes[i].wholeSection ? "*" : changes[i].key.c_str());
+	}
+}
+
+void TestSubscribe()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	Ini ini;
+	CreateTestSet(ini, 3, 3);
+	ini.SaveFile("test-subscribe.ini");
+
+	ini.Subscribe("sect0", "key0", OnChange, (void*)"key sect0.key0");
+	ini.Subscribe("sect1", NULL, OnChange, (void*)"section sect1");
+	int prefix = ini.SubscribePrefix("sect", "key1", OnChange, (void*)"prefix sect*.key1*");
+
+	ini.SetValue("sect0", "key0", "changed");
+	ini.SetValue("sect0", "key0", "changed"); //unchanged, no dispatch
+	ini.SetValue("sect2", "key2", "nobody listens");
+
+	ini.BeginBatch();
+	ini.SetValue("sect1", "key1", 1);
+	ini.SetValue("sect1", "key1", 2);
+	ini.SetValue("sect1", "key2", 3);
+	ini.SetValue("sect2", "key1", 4);
+	ini.EndBatch();
+
+	ini.Unsubscribe(prefix);
+	//LoadFile reports only the keys changed above, not the whole file.
+	ini.SetValue("sect1", "key0", "val0");
+	ini.LoadFile("test-subscribe.ini");
+
+	//The contents from a string no longer belong to the file, with the subscribers as without.
+	std::string text = ini.ToString();
+	ini.FromString(text.c_str(), text.size());
+	Ini plain;
+	plain.LoadFile("test-subscribe.ini");
+	plain.FromString(text.c_str(), text.size());
+	LOGN("file name after FromString : '%s', without subscribers : '%s'\n", ini.GetFileName(), plain.GetFileName());
+}
+
+void TestDiffPatch()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	Ini a(4*1024*1024);
+	Ini b(4*1024*1024);
+	CreateTestSet(a, 100, 1000);
+	CreateTestSet(b, 100, 1000);
+	b.SetValue("sect5", "key5", "modified");
+	b.SetValue("sect5", "added", "added");
+	b.SetValue("added", "key0", "added");
+	b.SetValue("sect9", "key9", "");
+
+	IniPatch patch;
+	Stopwatch(1, "Diff 100000 items");
+	a.Diff(b, patch);
+	Stopwatch(0, "Diff 100000 items");
+	LOGN("added=%d, removed=%d, modified=%d\n", patch.GetCount(IniPatch::Added), patch.GetCount(IniPatch::Removed), patch.GetCount(IniPatch::Modified));
+
+	Ini c(4*1024*1024);
+	CreateTestSet(c, 100, 1000);
+	c.SetValue("sect7", "only-in-c", "removed by the patch");
+	std::string text = patch.ToString();
+	LOGN("patch :\n%s", text.c_str());
+	IniPatch parsed;
+	bool result = parsed.FromString(text.c_str(), text.size());
+	bool same = result && parsed.GetCount() == patch.GetCount();
+	for (int i=0; same && i<patch.GetCount(); i++) {
+		same = parsed.GetOp(i) == patch.GetOp(i) && !strcmp(parsed.GetSect(i), patch.GetSect(i))
+			&& !strcmp(parsed.GetKey(i), patch.GetKey(i)) && !strcmp(parsed.GetVal(i), patch.GetVal(i));
+	}
+	LOGN("FromString : %s, same entries : %s\n", result ? "ok" : "fail", same ? "yes" : "no");
+	Ini copy(4*1024*1024);
+	CreateTestSet(copy, 100, 1000);
+	copy.ApplyPatch(parsed);
+	LOGN("parsed patch applied equals the target : %s\n", copy.ToString() == b.ToString() ? "yes" : "no");
+
+	IniPatch toB;
+	c.Diff(b, toB); //c has one more key than a
+	LOGN("ApplyPatch : %d items changed\n", c.ApplyPatch(toB));
+	LOGN("patched equals the target : %s\n", c.ToString() == b.ToString() ? "yes" : "no");
+
+	Ini d;
+	d.SetValue("sect5", "mine", "kept");
+	int changes = d.Merge(b);
+	LOGN("Merge : %d items changed, mine=%s\n", changes, d.GetValueStr("sect5", "mine"));
+}
+
+struct LogCounter {
+	std::atomic<int> lines;
+	std::atomic<int> broken;
+};
+
+void CountLog(int level, const char* msg, void* context)
+{
+	LogCounter* counter = (LogCounter*)context;
+	counter->lines++;
+	//[HH:MM:SS.MLS][INI]
+	if (strlen(msg) < 19 || msg[0] != '[' || msg[3] != ':' || msg[6] != ':' || msg[9] != '.' || msg[13] != ']') {
+		counter->broken++;
+	}
+}
+
+void AsyncLogWorker(int n)
+{
+	for (int i=0; i<n; i++) {
+		LOGN("async log %d\n", i);
+	}
+}
+
+void TestAsyncLog()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	LogCounter counter;
+	counter.lines = 0;
+	counter.broken = 0;
+	Ini::SetLogFunc(CountLog, &counter);
+	Ini::StartAsyncLog(4096);
+	Stopwatch(1);
+	std::vector<std::thread> threads;
+	for (int t=0; t<4; t++) {
+		threads.push_back(std::thread(AsyncLogWorker, 10000));
+	}
+	for (int t=0; t<4; t++) {
+		threads[t].join();
+	}
+	double sec = Stopwatch(0);
+	Ini::StopAsyncLog();
+	Ini::SetLogFunc(NULL);
+	LOGN("40000 logs from 4 threads in %.3lf seconds, %d lines written, %d broken time stamps\n", sec, counter.lines.load(), counter.broken.load());
+}
+
+void StatsWorker(int n)
+{
+	Ini ini;
+	CreateTestSet(ini, 10, 10);
+	for (int i=0; i<n; i++) {
+		ini.GetValueStr("sect1", (i & 1) ? "key1" : "nokey");
+	}
+}
+
+void TestStats()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	Ini::EnableStats(true);
+	Ini::ResetStats();
+	{
+		Ini ini(1024);
+		CreateTestSet(ini, 100, 100);
+		ini.SaveFile("test-stats.ini");
+		ini.LoadFile("test-stats.ini");
+		std::thread worker(StatsWorker, 10000);
+		StatsWorker(10000);
+		worker.join();
+	}
+	Ini::EnableStats(false);
+	Ini::Stats stats;
+	Ini::GetStats(stats);
+	LOGN("hit=%llu, miss=%llu, lookup p50=%lluns p99=%lluns\n", stats.counters[Ini::StatLookupHit], stats.counters[Ini::StatLookupMiss],
+		stats.GetPercentileNs(Ini::StatLookupTime, 50), stats.GetPercentileNs(Ini::StatLookupTime, 99));
+	LOGN("stats :\n%s", Ini::DumpStats().c_str());
+
+	//The counts of the finished threads stay, their blocks are reused.
+	Ini::EnableStats(true);
+	Ini::ResetStats();
+	for (int i=0; i<200; i++) {
+		std::thread worker(StatsWorker, 100);
+		worker.join();
+	}
+	Ini::EnableStats(false);
+	Ini::GetStats(stats);
+	LOGN("200 finished threads : miss=%llu\n", stats.counters[Ini::StatLookupMiss]);
+}
+
+void TestWriteBehind()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	const char* path = "test-write-behind.ini";
+	Ini::Stats stats;
+	Ini::EnableStats(true);
+	Ini::ResetStats();
+	{
+		ConcurrentIni ini;
+		ini.StartWriteBehind(path, 50, 100000, 1000);
+		Stopwatch(1);
+		for (int i=0; i<1000; i++) {
+			ini.SetValueInt("sect", "key", i);
+		}
+		Stopwatch(0, "1000 SetValue with write-behind");
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		Ini::GetStats(stats);
+		LOGN("files written after the quiet period : %llu\n", stats.timers[Ini::StatSaveTime].count);
+
+		ini.SetValueStr("sect", "flushed", "yes");
+		LOGN("Flush : %s\n", ini.Flush() ? "ok" : "fail");
+		Ini saved;
+		saved.LoadFile(path);
+		LOGN("saved key=%s, flushed=%s\n", saved.GetValueStr("sect", "key"), saved.GetValueStr("sect", "flushed"));
+
+		ini.SetValueStr("sect", "stopped", "yes");
+	}
+	Ini::EnableStats(false);
+	Ini::GetStats(stats);
+	Ini saved;
+	saved.LoadFile(path);
+	LOGN("files written=%llu, saved at the destruction : %s\n", stats.timers[Ini::StatSaveTime].count, saved.GetValueStr("sect", "stopped"));
+}
+
+struct AsyncDone {
+	std::atomic<int> done;
+	bool result;
+};
+
+void OnAsyncDone(Ini* ini, bool result, void* context)
+{
+	AsyncDone* async = (AsyncDone*)context;
+	async->result = result;
+	async->done++;
+}
+
+bool WaitAsync(AsyncDone& async)
+{
+	while (!async.done) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	async.done = 0;
+	return async.result;
+}
+
+void TestAsyncLoadSave()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	Ini ini(2*1024*1024);
+	CreateTestSet(ini, 100, 1000);
+	AsyncDone async;
+	async.done = 0;
+
+	Stopwatch(1);
+	ini.SaveFileAsync("test-async.ini", OnAsyncDone, &async);
+	bool saved = WaitAsync(async);
+	Stopwatch(0, "SaveFileAsync");
+	Ini checked;
+	LOGN("SaveFileAsync : %s, CRC checked by LoadFile : %s\n", saved ? "ok" : "fail", checked.LoadFile("test-async.ini") ? "ok" : "fail");
+
+	Ini loaded;
+	Stopwatch(1);
+	loaded.LoadFileAsync("test-async.ini", OnAsyncDone, &async);
+	bool result = WaitAsync(async);
+	Stopwatch(0, "LoadFileAsync");
+	LOGN("LoadFileAsync : %s, same contents : %s\n", result ? "ok" : "fail", loaded.ToString() == ini.ToString() ? "yes" : "no");
+
+	ini.SaveFileAsync("test-async-nocrc.ini", OnAsyncDone, &async, false);
+	WaitAsync(async);
+	loaded.LoadFileAsync("test-async-nocrc.ini", OnAsyncDone, &async, false);
+	result = WaitAsync(async);
+	LOGN("without CRC : %s, same contents : %s\n", result ? "ok" : "fail", loaded.ToString() == ini.ToString() ? "yes" : "no");
+
+	loaded.LoadFileAsync("not-exist.ini", OnAsyncDone, &async);
+	LOGN("missing file : %s\n", WaitAsync(async) ? "ok" : "fail");
+}
+
+void TestLoader()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini::SetLogLevel(Ini::Normal);
+	char path[64];
+	for (int i=0; i<32; i++) {
+		Ini ini;
+		CreateTestSet(ini, 10, 100);
+		ini.SetValue("file", "index", i);
+		snprintf(path, sizeof(path), "test-%02d-loader.ini", i);
+		ini.SaveFile(path);
+	}
+	FILE* broken = fopen("test-broken-loader.ini", "wb");
+	fputs("CRC=00000000\n[sect]\nkey=val\n", broken);
+	fclose(broken);
+
+	IniLoader loader;
+	int errors = loader.LoadDir(".", "-loader.ini");
+	double wallSec, readSec, crcSec, parseSec;
+	loader.GetTimes(wallSec, readSec, crcSec, parseSec);
+	LOGN("%d files, %d errors, wall %.3lf, read %.3lf, crc %.3lf, parse %.3lf seconds\n", (int)loader.GetCount(), errors, wallSec, readSec, crcSec, parseSec);
+	for (size_t i=0; i<loader.GetCount(); i++) {
+		const IniLoader::Result& result = loader.GetResult(i);
+		if (result.ini == NULL) {
+			LOGN("%s : %s\n", result.path.c_str(), result.error.c_str());
+		} else if (result.ini->GetValueInt("file", "index", -1) != (int)i) {
+			LOGE("%s : wrong contents\n", result.path.c_str());
+		}
+	}
+	double oneThreadSec;
+	loader.LoadDir(".", "-loader.ini", true, 1);
+	loader.GetTimes(oneThreadSec, readSec, crcSec, parseSec);
+	LOGN("1 thread wall %.3lf seconds, %.1fx by %u cores\n", oneThreadSec, oneThreadSec / wallSec, std::thread::hardware_concurrency());
+
+	Ini* kept = loader.Release(0);
+	loader.Clear();
+	LOGN("released ini kept : index=%d\n", kept->GetValueInt("file", "index", -1));
+	delete kept;
+
+	errors = loader.ValidateDir(".", "-loader.ini");
+	loader.GetTimes(wallSec, readSec, crcSec, parseSec);
+	LOGN("validated %d files, %d errors, wall %.3lf, crc %.3lf seconds\n", (int)loader.GetCount(), errors, wallSec, crcSec);
+	for (size_t i=0; i<loader.GetCount(); i++) {
+		if (!loader.GetResult(i).error.empty()) {
+			LOGN("%s : %s\n", loader.GetResult(i).path.c_str(), loader.GetResult(i).error.c_str());
+		}
+	}
+}
+
+void TestOverlay()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini defaults, site, device;
+	CreateTestSet(defaults, 10, 100);
+	site.SetValueStr("sect1", "key1", "site1");
+	site.SetValueStr("site", "name", "seoul");
+	device.SetValueStr("SECT1", "KEY1", "device1");
+	device.SetValueStr("sect2", "key100", "added");
+	device.SetValueStr("a", "first", "1");
+
+	IniOverlay overlay;
+	overlay.AddLayer(defaults);
+	overlay.AddLayer(site);
+	overlay.AddLayer(device);
+	int layer = -1;
+	overlay.FindItem("sect1", "key1", &layer);
+	LOGN("sect1.key1=%s (layer %d), sect1.key2=%s, site.name=%s, sect2.key100=%s, missing=%s\n",
+		overlay.GetValueStr("sect1", "key1"), layer, overlay.GetValueStr("sect1", "key2"), overlay.GetValueStr("site", "name"),
+		overlay.GetValueStr("sect2", "key100"), overlay.GetValueStr("none", "key", "default"));
+
+	//The same contents copied into one Ini, the way it was done before.
+	Ini merged;
+	for (size_t i=0; i<overlay.GetLayerCount(); i++) {
+		for (Ini::SectionRange::const_iterator sect=overlay.GetLayer(i).Sections().begin(); sect!=overlay.GetLayer(i).Sections().end(); sect++) {
+			for (Ini::ItemRange::const_iterator item=sect->items.begin(); item!=sect->items.end(); item++) {
+				merged.SetValueStr(sect->key, item->key, item->val);
+			}
+		}
+	}
+	std::vector<const char*> sections;
+	std::vector<const IniOverlay::Item*> items;
+	overlay.GetSections(sections);
+	bool same = sections.size() == merged.Sections().size();
+	for (size_t i=0; same && i<sections.size(); i++) {
+		Ini::ItemRange mergedItems = merged.Items(sections[i]);
+		overlay.GetItems(sections[i], items);
+		same = items.size() == mergedItems.size();
+		for (size_t j=0; same && j<items.size(); j++) {
+			same = 0 == StringNoCaseCompare(items[j]->key, mergedItems[j].key, Ini::maxSectKeyLen) && 0 == strcmp(items[j]->val, mergedItems[j].val);
+		}
+	}
+	LOGN("%d sections, first %s, same as merged : %s\n", (int)sections.size(), sections.empty() ? "" : sections[0], same ? "yes" : "no");
+
+	Stopwatch(1);
+	for (int i=0; i<100000; i++) {
+		overlay.GetValueStr("sect5", "key50");
+	}
+	Stopwatch(0, "overlay lookup 100000 times");
+	Stopwatch(1);
+	for (int i=0; i<100000; i++) {
+		merged.GetValueStr("sect5", "key50");
+	}
+	Stopwatch(0, "merged lookup 100000 times");
+
+	device.SetValueStr("new", "key", "val");
+	overlay.Invalidate();
+	LOGN("after a new section in the device : new.key=%s\n", overlay.GetValueStr("new", "key"));
+}
+
+void TestSectValues()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini(2*1024*1024);
+	CreateTestSet(ini, 100, 1000);
+	const char* keys[] = { "key7", "KEY3", "none", "key999", "key0", "key50" };
+	const size_t count = sizeof(keys) / sizeof(keys[0]);
+	Ini::ValueSpan values[count];
+	int found = ini.GetSectValues("sect1", keys, count, values);
+	LOGN("%d of %d found\n", found, (int)count);
+	for (size_t i=0; i<count; i++) {
+		LOGN("%s=%s (%d)\n", keys[i], values[i].val ? values[i].val : "NULL", (int)values[i].len);
+	}
+	LOGN("missing section : %d found\n", ini.GetSectValues("none", keys, count, values));
+	const char* withNull[] = { "key7", NULL, "key0", NULL };
+	found = ini.GetSectValues("sect1", withNull, 4, values);
+	LOGN("NULL keys : %d found, key0=%s\n", found, values[2].val ? values[2].val : "NULL");
+
+	//A group of 50 settings, one by one and in one pass.
+	char names[50][16];
+	const char* group[50];
+	for (int i=0; i<50; i++) {
+		snprintf(names[i], sizeof(names[i]), "key%d", i * 20);
+		group[i] = names[i];
+	}
+	Ini::ValueSpan groupValues[50];
+	Stopwatch(1);
+	for (int n=0; n<10000; n++) {
+		for (int i=0; i<50; i++) {
+			groupValues[i].val = ini.GetValueStr("sect50", group[i], NULL);
+		}
+	}
+	Stopwatch(0, "GetValueStr 50 keys 10000 times");
+	Stopwatch(1);
+	for (int n=0; n<10000; n++) {
+		ini.GetSectValues("sect50", group, 50, groupValues);
+	}
+	Stopwatch(0, "GetSectValues 50 keys 10000 times");
+	LOGN("last of the group : %s\n", groupValues[49].val);
+}
+
+void TestPrefixRanges()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini(8*1024*1024);
+	char sect[32];
+	for (int i=0; i<100000; i++) {
+		snprintf(sect, sizeof(sect), i % 100 ? "device.%05d" : "SENSOR.%05d", i);
+		ini.SetValueStr(sect, "ch3.gain", "1.5");
+	}
+	ini.SetValueStr("sensorx", "name", "not a sensor.");
+	ini.SetValueStr("sensor.00100", "ch1.gain", "2");
+	ini.SetValueStr("sensor.00100", "CH1.offset", "3");
+	ini.SetValueStr("sensor.00100", "ch10.gain", "4");
+	ini.SetValueStr("sensor.00100", "ch2.gain", "5");
+
+	Stopwatch(1);
+	Ini::SectionRange sensors = ini.SectionsWithPrefix("sensor.");
+	Stopwatch(0, "SectionsWithPrefix");
+	int filtered = 0;
+	Stopwatch(1);
+	for (const char* s = ini.FindFirstSection(); s; s = ini.FindNextSection()) {
+		filtered += 0 == StringNoCaseCompare(s, "sensor.", strlen("sensor."));
+	}
+	Stopwatch(0, "FindFirstSection and filtering");
+	LOGN("sensors : %d, filtered : %d, first %s, last %s\n", (int)sensors.size(), filtered,
+		sensors.empty() ? "" : sensors.begin()->key, sensors.empty() ? "" : sensors[sensors.size() - 1].key);
+
+	Ini::ItemRange ch1 = ini.ItemsWithPrefix("sensor.00100", "ch1.");
+	for (Ini::ItemRange::const_iterator item=ch1.begin(); item!=ch1.end(); item++) {
+		LOGN("ch1. : %s=%s\n", item->key, item->val);
+	}
+	Ini::ItemRange chs = ini.Items("sensor.00100", "ch1", "ch2");
+	LOGN("[ch1, ch2) : %d keys, [ch2, end) : %d keys, [device.99990, sensor.) : %d sections\n", (int)chs.size(),
+		(int)ini.Items("sensor.00100", "ch2", NULL).size(), (int)ini.Sections("device.99990", "sensor.").size());
+	LOGN("no match : %d, missing section : %d, reversed : %d\n", (int)ini.SectionsWithPrefix("zzz").size(),
+		(int)ini.ItemsWithPrefix("none", "ch").size(), (int)ini.Sections("sensor.", "device.").size());
+}
+
+void TestCompactIni()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	Ini ini(2*1024*1024);
+	CreateTestSet(ini, 100, 100);
+	CompactIni compact;
+	compact.Assign(ini);
+	LOGN("item %d bytes, compact item %d bytes, same contents : %s\n", (int)sizeof(Ini::Item), (int)sizeof(CompactIni::Item),
+		compact.ToString() == ini.ToString() ? "yes" : "no");
+
+	//Same changes to both.
+	const char* changes[][3] = {
+		{ "sect5", "key5", "v" }, //shorter
+		{ "sect5", "key6", "a longer value than before" },
+		{ "sect5", "KEY6", "case insensitive key" },
+		{ "sect5", "key10a", "new key" },
+		{ "a", "first", "new section in front" },
+		{ "sect99", "last", "new key at the end" },
+		{ "", "global", "empty section" },
+	};
+	for (size_t i=0; i<sizeof(changes)/sizeof(changes[0]); i++) {
+		ini.SetValueStr(changes[i][0], changes[i][1], changes[i][2]);
+		compact.SetValueStr(changes[i][0], changes[i][1], changes[i][2]);
+	}
+	compact.SetValueStr("sect7", "copy", compact.GetValueStr("sect5", "key6"));
+	ini.SetValueStr("sect7", "copy", ini.GetValueStr("sect5", "key6"));
+	LOGN("after the changes : same contents : %s, sect5.key6=%s, a.first=%s, sect7.copy=%s, missing=%s\n",
+		compact.ToString() == ini.ToString() ? "yes" : "no", compact.GetValueStr("sect5", "key6"), compact.GetValueStr("a", "first"),
+		compact.GetValueStr("sect7", "copy"), compact.GetValueStr("sect7", "none", "default"));
+	size_t before = compact.GetMemoryUsage();
+	compact.ShrinkToFit();
+	LOGN("ShrinkToFit : %d -> %d bytes, same contents : %s\n", (int)before, (int)compact.GetMemoryUsage(), compact.ToString() == ini.ToString() ? "yes" : "no");
+
+	compact.SaveFile("test-compact.ini");
+	CompactIni loaded;
+	bool result = loaded.LoadFile("test-compact.ini");
+	LOGN("SaveFile and LoadFile : %s, same contents : %s, %d sections, %d items, %d bytes\n", result ? "ok" : "fail",
+		loaded.ToString() == ini.ToString() ? "yes" : "no", loaded.GetSectCount(), loaded.GetItemCount(), (int)loaded.GetMemoryUsage());
+	LOGN("LoadFile of a missing file : %s, %d sections left\n", loaded.LoadFile("not-exist.ini") ? "ok" : "fail", loaded.GetSectCount());
+
+	Stopwatch(1);
+	for (int i=0; i<100000; i++) {
+		compact.GetValueStr("sect50", "key50");
+	}
+	Stopwatch(0, "compact lookup 100000 times");
+}
+
+static size_t ArenaWorkload(IniArena& arena)
+{
+	arena.Reset();
+	{
+		Ini ini(64*1024);
+		CreateTestSet(ini, 20, 100);
+		ini.SaveFile("test-arena.ini");
+		Ini loaded(64*1024);
+		loaded.LoadFile("test-arena.ini");
+		LOGN("loaded in the arena : %d items, same contents : %s\n", loaded.GetItemCount(), loaded.ToString() == ini.ToString() ? "yes" : "no");
+	}
+	return arena.GetPeak();
+}
+
+void TestArena()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	static char buf[4*1024*1024];
+	IniArena arena(buf, sizeof(buf));
+	IniAllocator allocator = arena.GetAllocator();
+	Ini::SetAllocator(&allocator);
+
+	size_t peak = ArenaWorkload(arena);
+	LOGN("peak %d of %d bytes, %d bytes used after the Ini are gone\n", (int)peak, (int)arena.GetSize(), (int)arena.GetUsed());
+	LOGN("same peak on the second run : %s\n", ArenaWorkload(arena) == peak ? "yes" : "no");
+
+	//Each reload frees the last generation into the free lists, the next one takes the blocks back.
+	arena.Reset();
+	{
+		Ini ini(64*1024);
+		std::unique_ptr<Ini> current(new Ini(64*1024));
+		size_t used = 0;
+		size_t reloadPeak = 0;
+		bool flat = true;
+		for (int i=0; i<100; i++) {
+			std::unique_ptr<Ini> next(new Ini(64*1024));
+			flat &= next->LoadFile("test-arena.ini");
+			current.swap(next);
+			flat &= ini.LoadFile("test-arena.ini");
+			if (i == 2) {
+				used = arena.GetUsed();
+				reloadPeak = arena.GetPeak();
+			} else if (i > 2) {
+				flat &= arena.GetUsed() == used && arena.GetPeak() == reloadPeak;
+			}
+		}
+		LOGN("100 reloads in the arena : %d items, %d bytes used, peak %d, flat : %s\n", current->GetItemCount(),
+			(int)arena.GetUsed(), (int)arena.GetPeak(), flat ? "yes" : "no");
+	}
+
+	//Threads allocating at the same time never get the same block.
+	arena.Reset();
+	std::vector<std::thread> threads;
+	std::atomic<int> overlaps(0);
+	for (int t=0; t<4; t++) {
+		threads.push_back(std::thread([t, &overlaps]() {
+			std::vector<unsigned char*> blocks;
+			for (int i=0; i<1000; i++) {
+				unsigned char* block = (unsigned char*)IniAlloc(64);
+				if (block) {
+					memset(block, t + 1, 64);
+					blocks.push_back(block);
+				}
+			}
+			for (size_t i=0; i<blocks.size(); i++) {
+				for (int b=0; b<64; b++) {
+					if (blocks[i][b] != t + 1) {
+						overlaps++;
+						break;
+					}
+				}
+			}
+		}));
+	}
+	for (size_t t=0; t<threads.size(); t++) {
+		threads[t].join();
+	}
+	LOGN("threads sharing the arena : %d bytes used, overlapped blocks : %d\n", (int)arena.GetUsed(), overlaps.load());
+	arena.Reset();
+
+	//Fill a small arena up, the set fails and the Ini stays usable.
+	IniArena small(buf, 32*1024);
+	allocator = small.GetAllocator();
+	Ini::SetAllocator(&allocator);
+	{
+		Ini ini(1024);
+		int count = 0;
+		char key[32];
+		for (; count < 100000; count++) {
+			snprintf(key, sizeof(key), "key%d", count);
+			if (ini.SetValueStr("sect", key, "value")) {
+				break;
+			}
+		}
+		LOGN("small arena full after %d items, key0=%s, GetItemCount=%d\n", count, ini.GetValueStr("sect", "key0"), ini.GetItemCount());
+	}
+
+	//The ConcurrentIni grows the item lists of the existing sections, it fails the same way.
+	IniArena concurrent(buf, 256*1024);
+	allocator = concurrent.GetAllocator();
+	Ini::SetAllocator(&allocator);
+	{
+		ConcurrentIni ini(1024);
+		int count = 0;
+		char key[32];
+		for (; count < 100000; count++) {
+			snprintf(key, sizeof(key), "key%d", count);
+			if (ini.SetValueStr("sect", key, "value")) {
+				break;
+			}
+		}
+		LOGN("concurrent ini full after %d items, key0=%s\n", count, ini.GetValueString("sect", "key0").c_str());
+	}
+
+	//The CompactIni and the patches of the Merge live in the arena as well.
+	IniArena compact(buf, 64*1024);
+	allocator = compact.GetAllocator();
+	Ini::SetAllocator(&allocator);
+	{
+		CompactIni ini;
+		int count = 0;
+		char key[32];
+		for (; count < 100000; count++) {
+			snprintf(key, sizeof(key), "key%d", count);
+			if (ini.SetValueStr("sect", key, "value")) {
+				break;
+			}
+		}
+		LOGN("compact ini full after %d items, key0=%s, GetItemCount=%d\n", count, ini.GetValueStr("sect", "key0"), ini.GetItemCount());
+		ini.Reset();
+		for (count = 0; count < 100000; count++) {
+			snprintf(key, sizeof(key), "sect%d", count);
+			if (ini.SetValueStr(key, "key", "value")) {
+				break;
+			}
+		}
+		LOGN("compact ini full after %d sections, GetSectCount=%d, GetItemCount=%d\n", count, ini.GetSectCount(), ini.GetItemCount());
+	}
+	{
+		Ini a(1024);
+		Ini b(1024);
+		CreateTestSet(b, 2, 20);
+		int changes = a.Merge(b);
+		size_t used = compact.GetUsed();
+		char key[32];
+		int count = 0;
+		for (; count < 100000 && changes > 0; count++) {
+			snprintf(key, sizeof(key), "more%d", count);
+			b.SetValueStr("sect", key, "value");
+			changes = a.Merge(b);
+		}
+		LOGN("merge in the arena : %d bytes used after the first, %d merges until full, merged items %d of %d\n", (int)used, count,
+			a.GetItemCount(), b.GetItemCount());
+	}
+	Ini::SetAllocator(NULL);
+}
+
+void TestFusedCRC()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	const char* path = "test-fused.ini";
+	CreateTestFile(path);
+	Ini ini(2*1024*1024);
+	Stopwatch(1);
+	for (int i=0; i<10; i++) {
+		ini.LoadFile(path, false);
+	}
+	Stopwatch(0, "LoadFile without the CRC check 10 times");
+	Stopwatch(1);
+	bool result = true;
+	for (int i=0; i<10; i++) {
+		result &= ini.LoadFile(path, true);
+	}
+	Stopwatch(0, "LoadFile with the CRC check 10 times");
+	std::string loaded = ini.ToString();
+	LOGN("checked load : %s, %d items\n", result ? "ok" : "fail", ini.GetItemCount());
+
+	//Break a byte in the middle, the loaded contents stay.
+	FILE* fp = fopen(path, "r+b");
+	if (fp) {
+		fseek(fp, 0, SEEK_END);
+		fseek(fp, ftell(fp) / 2, SEEK_SET);
+		fputc('#', fp);
+		fclose(fp);
+	}
+	result = ini.LoadFile(path, true);
+	LOGN("broken file : %s, contents kept : %s\n", result ? "ok" : "fail", ini.ToString() == loaded ? "yes" : "no");
+	Ini fresh;
+	result = fresh.LoadFile(path, true);
+	LOGN("broken file into an empty Ini : %s, %d sections\n", result ? "ok" : "fail", fresh.GetSectCount());
+	result = fresh.LoadFile(path, false);
+	LOGN("broken file without the CRC check : %s, %d items\n", result ? "ok" : "fail", fresh.GetItemCount());
+}
+
+void TestAdoptBuffer()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	const char* path = "test-adopt.ini";
+	CreateTestFile(path);
+	//The small pool is only the overflow area, the loaded tokens stay in the read buffer.
+	Ini ini(1024);
+	Stopwatch(1);
+	bool result = ini.LoadFile(path, true);
+	Stopwatch(0, "LoadFile adopting the buffer");
+	LOGN("load : %s, %d items, pool room : %d\n", result ? "ok" : "fail", ini.GetItemCount(), ini.GetPoolRoom());
+
+	//Grow values past the loaded ones, they go to the pool and the adopted tokens stay.
+	const char* sect = ini.FindFirstSection();
+	const char* key = NULL;
+	const char* val = NULL;
+	ini.FindFirstKey(sect, &key, &val);
+	std::string longer = std::string(val) + "-grown-past-the-loaded-token";
+	ini.SetValueStr(sect, key, longer.c_str());
+	ini.SetValueStr("AdoptTest", "NewKey", "NewValue");
+	for (int i=0; i<100; i++) {
+		ini.SetValueInt("AdoptTest", "Counter", i);
+	}
+	LOGN("grown value : %s\n", strcmp(ini.GetValueStr(sect, key), longer.c_str()) == 0 ? "ok" : "fail");
+
+	std::string saved = ini.ToString();
+	ini.SaveFile(path);
+	Ini reloaded;
+	result = reloaded.LoadFile(path, true);
+	LOGN("reload : %s, same contents : %s\n", result ? "ok" : "fail", reloaded.ToString() == saved ? "yes" : "no");
+
+	//Loading again frees the previously adopted buffer.
+	result = ini.LoadFile(path, true);
+	LOGN("load again : %s, same contents : %s\n", result ? "ok" : "fail", ini.ToString() == saved ? "yes" : "no");
+}
+
+void TestUnsortedLoad()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	//A hand edited file in random order with the duplicated keys, the last one wins.
+	const char* path = "test-unsorted.ini";
+	Ini expected(2*1024*1024);
+	std::string text;
+	unsigned int seed = 1;
+	for (int i=0; i<100000; i++) {
+		seed = seed * 1103515245 + 12345;
+		int sect = (seed >> 16) % 100;
+		seed = seed * 1103515245 + 12345;
+		int key = (seed >> 16) % 1000;
+		char line[128];
+		snprintf(line, sizeof(line), "[sect%d]\nkey%d=val%d\n", sect, key, i);
+		text += line;
+		snprintf(line, sizeof(line), "sect%d", sect);
+		char k[32];
+		char v[32];
+		snprintf(k, sizeof(k), "key%d", key);
+		snprintf(v, sizeof(v), "val%d", i);
+		expected.SetValueStr(line, k, v);
+	}
+	FILE* fp = fopen(path, "wb");
+	if (fp) {
+		fwrite(text.data(), 1, text.size(), fp);
+		fclose(fp);
+	}
+	Ini ini(1024);
+	Stopwatch(1);
+	bool result = ini.LoadFile(path, false);
+	Stopwatch(0, "LoadFile of the unsorted file");
+	LOGN("unsorted load : %s, %d items, same as set one by one : %s\n", result ? "ok" : "fail",
+		ini.GetItemCount(), ini.ToString() == expected.ToString() ? "yes" : "no");
+
+	//A CRC'd file edited out of order is sorted again instead of breaking the lookups.
+	CreateTestFile(path);
+	fp = fopen(path, "ab");
+	if (fp) {
+		fputs("\n[sect0]\nkey1=edited\nkey0001=added\n", fp);
+		fclose(fp);
+	}
+	Ini::Stats before;
+	Ini::Stats after;
+	Ini::EnableStats(true);
+	Ini::GetStats(before);
+	result = ini.LoadFile(path, false);
+	Ini::GetStats(after);
+	Ini::EnableStats(false);
+	bool found = true;
+	for (int i=0; i<100; i+=7) {
+		char sect[32];
+		snprintf(sect, sizeof(sect), "sect%d", i);
+		for (int j=0; j<1000; j+=13) {
+			char key[32];
+			snprintf(key, sizeof(key), "key%d", j);
+			found &= ini.IsKey(sect, key);
+		}
+	}
+	LOGN("edited load : %s, %d sections, all keys found : %s, key1=%s, key0001=%s, sorted %llu time(s)\n",
+		result ? "ok" : "fail", ini.GetSectCount(), found ? "yes" : "no",
+		ini.GetValueStr("sect0", "key1"), ini.GetValueStr("sect0", "key0001"),
+		after.counters[Ini::StatParseSort] - before.counters[Ini::StatParseSort]);
+}
+
+void TestMultiValue()
+{
+	LOGN("<<%s>>\n", __FUNCTION__);
+
+	const char* path = "test-multi.ini";
+	std::string text = "[cal]\ngain=1\noffset=0.5\ngain=2\ngain = 3\n[cal]\ngain=4\ntable=";
+	const int tableSize = 10000;
+	for (int i=0; i<tableSize; i++) {
+		char element[32];
+		snprintf(element, sizeof(element), i ? ", %d.5" : "%d.5", i);
+		text += element;
+	}
+	text += "\n";
+	FILE* fp = fopen(path, "wb");
+	if (fp) {
+		fwrite(text.data(), 1, text.size(), fp);
+		fclose(fp);
+	}
+
+	Ini single;
+	single.LoadFile(path, false);
+	LOGN("repeated keys overwrite : gain=%s\n", single.GetValueStr("cal", "gain"));
+
+	Ini ini;
+	ini.SetMultiValueKeys(true);
+	bool result = ini.LoadFile(path, false);
+	Ini::ValueRange gains = ini.GetValues("cal", "gain");
+	std::string joined;
+	for (size_t i=0; i<gains.size(); i++) {
+		joined += std::string(gains[i].val, gains[i].len) + "|";
+	}
+	LOGN("repeated keys joined : %s, gain=%s, elements %s\n", result ? "ok" : "fail", ini.GetValueStr("cal", "gain"), joined.c_str());
+
+	ini.SetValueStrMulti("cal", "gain", "5");
+	ini.SetValueStrMulti("cal", "bias", "7");
+	int ints[8];
+	size_t n = ini.GetValuesInt("cal", "gain", ints, 8);
+	LOGN("appended : %d elements, last %d, bias=%s\n", (int)n, n ? ints[n - 1] : -1, ini.GetValueStr("cal", "bias"));
+
+	std::vector<double> table(tableSize);
+	Stopwatch(1);
+	for (int i=0; i<100; i++) {
+		n = ini.GetValuesDouble("cal", "table", table.data(), table.size());
+	}
+	Stopwatch(0, "GetValuesDouble of 10000 elements 100 times");
+	Ini::ValueRange spans = ini.GetValues("cal", "table");
+	LOGN("table : %d converted, %d spans, table[9999]=%.1f, span[9999]=%.*s\n", (int)n, (int)spans.size(),
+		table[tableSize - 1], (int)spans[tableSize - 1].len, spans[tableSize - 1].val);
+	LOGN("index kept : %s\n", ini.GetValues("cal", "table").begin() == spans.begin() ? "yes" : "no");
+	ini.SetValueStrMulti("cal", "table", "10000.5");
+	spans = ini.GetValues("cal", "table");
+	LOGN("index dropped on append : %d spans, last %.*s\n", (int)spans.size(),
+		(int)spans[spans.size() - 1].len, spans[spans.size() - 1].val);
+
+	Ini grown;
+	Stopwatch(1);
+	for (int i=0; i<tableSize; i++) {
+		grown.SetValueStrMulti("cal", "list", "12345");
+	}
+	Stopwatch(0, "SetValueStrMulti of 10000 elements");
+	size_t listLen = strlen(grown.GetValueStr("cal", "list"));
+	LOGN("appended in place : %d elements, %d bytes\n", (int)grown.GetValues("cal", "list").size(), (int)listLen);
+
+	double none[2];
+	LOGN("missing key : %d elements, %d converted\n", (int)ini.GetValues("cal", "none").size(),
+		(int)ini.GetValuesDouble("cal", "none", none, 2));
+
+	ini.SaveFile(path);
+	Ini reloaded;
+	reloaded.SetMultiValueKeys(true);
+	result = reloaded.LoadFile(path, true);
+	LOGN("reload : %s, same contents : %s\n", result ? "ok" : "fail", reloaded.ToString() == ini.ToString() ? "yes" : "no");
+}
+
 int main()
 {
 	TestGetTimeStampBenchmark();
+	TestDisabledLogBenchmark();
 	TestBenchmarks();
 	TestLoadFile();
 	TestLoadFileWithWrongFile();
 	TestValidateFile();
 	TestSetValueFunctions();
 	TestFindFunctions();
+	TestRanges();
 	TestEmptySection();
 	TestToString();
 	TestSquareBracket();
 	TestDirtyIni();
 	TestReallocStrPool();
 	TestSaveContentsChangedFileOnly();
+	TestRawEncoding();
+	TestConcurrentBenchmarks();
+	TestSnapshot();
+	TestReloadFile();
+	TestSubscribe();
+	TestDiffPatch();
+	TestAsyncLog();
+	TestStats();
+	TestWriteBehind();
+	TestAsyncLoadSave();
+	TestLoader();
+	TestOverlay();
+	TestSectValues();
+	TestPrefixRanges();
+	TestCompactIni();
+	TestArena();
+	TestFusedCRC();
+	TestAdoptBuffer();
+	TestUnsortedLoad();
+	TestMultiValue();
 	return 0;
 }
\ No newline at end of file